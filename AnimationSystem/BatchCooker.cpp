@@ -0,0 +1,298 @@
+#include "BatchCooker.h"
+#include "ClipReducer.h"
+#include "CookedAsset.h"
+#include "ImportSession.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <fstream>
+#include <iomanip>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+const char* BatchCooker::ManifestName = "cook_manifest.txt";
+
+bool BatchCooker::CookDirectory(const char* i_directory, CookedData::VertexFormat i_format, ClipFormat i_clipformat)
+{
+	std::string directory = i_directory;
+	if (!directory.empty() && directory.back() != '/' && directory.back() != '\\')
+	{
+		directory += '/';
+	}
+
+	std::vector<std::string> files;
+	if (!ListFbxFiles(directory, files))
+	{
+		printf("Cannot list %s\n", i_directory);
+		return false;
+	}
+
+	std::vector<ManifestEntry> previous;
+	ReadManifest(directory + ManifestName, previous);
+
+	// Every file gets an entry in the new manifest, failed files keep hash 0 and are left out when it is written
+	std::vector<ManifestEntry> entries(files.size());
+	std::vector<uint64_t> hashes(files.size(), 0);
+	std::atomic<int> cooked(0);
+	std::atomic<int> skipped(0);
+	std::atomic<int> failed(0);
+
+	// Hash every file first, only the changed ones are imported
+	std::vector<int> changed(files.size(), 0);
+	ThreadPool::Get().ParallelFor(0, static_cast<int>(files.size()), [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			const std::string fbxpath = directory + files[i];
+			const std::string cookedpath = fbxpath.substr(0, fbxpath.find_last_of('.')) + ".cooked";
+
+			ManifestEntry& entry = entries[i];
+			entry.file = files[i];
+			entry.hash = 0;
+			entry.version = CookedData::ImporterVersion;
+			entry.cookedversion = CookedData::Version;
+			entry.format = static_cast<uint32_t>(i_format);
+			entry.clipformat = static_cast<uint32_t>(i_clipformat);
+
+			uint64_t hash;
+			if (!HashFile(fbxpath, hash))
+			{
+				printf("Cannot read %s\n", fbxpath.c_str());
+				failed++;
+				continue;
+			}
+
+			auto found = std::find_if(previous.begin(), previous.end(), [&](const ManifestEntry& i_entry) { return i_entry.file == files[i]; });
+			if (found != previous.end() && found->hash == hash && found->version == entry.version && found->cookedversion == entry.cookedversion && found->format == entry.format && found->clipformat == entry.clipformat && FileExists(cookedpath))
+			{
+				entry.hash = hash;
+				skipped++;
+				continue;
+			}
+
+			// The hash is only kept once the file is cooked
+			hashes[i] = hash;
+			changed[i] = 1;
+		}
+	});
+
+	std::vector<int> pending;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		if (changed[i])
+		{
+			pending.push_back(static_cast<int>(i));
+		}
+	}
+
+	// One import session per chunk keeps a manager alive for all of its files and imports the next file while the current one is cooked
+	ThreadPool::Get().ParallelFor(0, static_cast<int>(pending.size()), [&](int begin, int end)
+	{
+		ImportSession session;
+		std::vector<std::future<ImportedFile>> imports;
+		for (int p = begin; p < end; p++)
+		{
+			imports.push_back(session.Import(directory + files[pending[p]]));
+		}
+
+		for (int p = begin; p < end; p++)
+		{
+			int i = pending[p];
+			const std::string fbxpath = directory + files[i];
+			const std::string cookedpath = fbxpath.substr(0, fbxpath.find_last_of('.')) + ".cooked";
+
+			ImportedFile file = ThreadPool::Get().Wait(imports[p - begin]);
+			if (!CookImported(file, cookedpath, i_format, i_clipformat))
+			{
+				printf("Failed cooking %s\n", fbxpath.c_str());
+				failed++;
+				continue;
+			}
+
+			entries[i].hash = hashes[i];
+			cooked++;
+		}
+	});
+
+	entries.erase(std::remove_if(entries.begin(), entries.end(), [](const ManifestEntry& i_entry) { return i_entry.hash == 0; }), entries.end());
+	WriteManifest(directory + ManifestName, entries);
+
+	printf("%s: %d cooked, %d up to date, %d failed\n", i_directory, cooked.load(), skipped.load(), failed.load());
+	return failed == 0;
+}
+
+bool BatchCooker::CookFile(const std::string& i_fbxpath, const std::string& i_cookedpath, CookedData::VertexFormat i_format, ClipFormat i_clipformat)
+{
+	ImportSession session;
+	std::future<ImportedFile> import = session.Import(i_fbxpath);
+	ImportedFile file = ThreadPool::Get().Wait(import);
+	return CookImported(file, i_cookedpath, i_format, i_clipformat);
+}
+
+bool BatchCooker::CookImported(ImportedFile& io_file, const std::string& i_cookedpath, CookedData::VertexFormat i_format, ClipFormat i_clipformat)
+{
+	if (!io_file.loaded)
+	{
+		return false;
+	}
+
+	Skeleton& skeleton = io_file.skeleton;
+	for (AnimationClip& clip : io_file.clips)
+	{
+		clip.pSkeleton = &skeleton;
+		if (!skeleton.joints.empty() && !Importer::RemapToSkeleton(clip, skeleton))
+		{
+			return false;
+		}
+		if (i_clipformat == ClipFormat::Keyed && !ClipReducer::Reduce(clip, &skeleton))
+		{
+			return false;
+		}
+	}
+
+	std::vector<MeshLod> lods;
+	if (!io_file.mesh.empty())
+	{
+		printf("%s\n", io_file.path.c_str());
+		MeshOptimizer::PruneInfluences(io_file.mesh);
+		MeshSimplifier::BuildLodChain(io_file.mesh, io_file.index, io_file.submeshes, lods);
+		MeshOptimizer::BucketInfluences(io_file.mesh, io_file.index, io_file.submeshes, lods);
+		MeshOptimizer::Optimize(io_file.mesh, io_file.index, io_file.submeshes);
+	}
+
+	return CookedAsset::Cook(i_cookedpath.c_str(), skeleton, io_file.mesh, io_file.index, io_file.submeshes, lods, io_file.materials,
+		io_file.clips.data(), io_file.clips.size(), i_format, i_clipformat);
+}
+
+bool BatchCooker::HashFile(const std::string& i_filepath, uint64_t& o_hash)
+{
+	std::ifstream file(i_filepath, std::ios::binary);
+	if (file.fail())
+	{
+		return false;
+	}
+
+	uint64_t hash = 14695981039346656037ull;
+	std::vector<char> buffer(1 << 16);
+	while (file)
+	{
+		file.read(buffer.data(), buffer.size());
+		std::streamsize read = file.gcount();
+		for (std::streamsize i = 0; i < read; i++)
+		{
+			hash ^= static_cast<unsigned char>(buffer[i]);
+			hash *= 1099511628211ull;
+		}
+	}
+
+	// 0 marks a failed file in the manifest
+	o_hash = hash ? hash : 1;
+	return file.eof();
+}
+
+bool BatchCooker::ReadManifest(const std::string& i_filepath, std::vector<ManifestEntry>& o_entries)
+{
+	o_entries.clear();
+
+	std::ifstream file(i_filepath);
+	if (file.fail())
+	{
+		return false;
+	}
+
+	// One "<hash> <importer version> <cooked version> <vertex format> <clip format> <file name>" per line
+	ManifestEntry entry;
+	while (file >> std::hex >> entry.hash >> std::dec >> entry.version >> entry.cookedversion >> entry.format >> entry.clipformat >> std::ws && std::getline(file, entry.file))
+	{
+		o_entries.push_back(entry);
+	}
+
+	return true;
+}
+
+bool BatchCooker::WriteManifest(const std::string& i_filepath, const std::vector<ManifestEntry>& i_entries)
+{
+	std::ofstream file(i_filepath, std::ios::trunc);
+	if (file.fail())
+	{
+		printf("Cannot write %s\n", i_filepath.c_str());
+		return false;
+	}
+
+	for (const ManifestEntry& entry : i_entries)
+	{
+		file << std::hex << std::setw(16) << std::setfill('0') << entry.hash << std::dec << ' ' << entry.version << ' ' << entry.cookedversion << ' ' << entry.format << ' ' << entry.clipformat << ' ' << entry.file << '\n';
+	}
+
+	return !file.fail();
+}
+
+bool BatchCooker::ListFbxFiles(const std::string& i_directory, std::vector<std::string>& o_files)
+{
+	o_files.clear();
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((i_directory + "*.fbx").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		return GetLastError() == ERROR_FILE_NOT_FOUND;
+	}
+
+	do
+	{
+		if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		{
+			o_files.push_back(data.cFileName);
+		}
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	DIR* dir = opendir(i_directory.c_str());
+	if (!dir)
+	{
+		return false;
+	}
+
+	while (dirent* entry = readdir(dir))
+	{
+		std::string name = entry->d_name;
+		if (name.size() < 4)
+		{
+			continue;
+		}
+
+		std::string extension = name.substr(name.size() - 4);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+		if (extension == ".fbx")
+		{
+			o_files.push_back(name);
+		}
+	}
+	closedir(dir);
+#endif
+
+	// Same order on every platform, so the manifest does not change when nothing was recooked
+	std::sort(o_files.begin(), o_files.end());
+	return true;
+}
+
+bool BatchCooker::FileExists(const std::string& i_filepath)
+{
+#ifdef _WIN32
+	return GetFileAttributesA(i_filepath.c_str()) != INVALID_FILE_ATTRIBUTES;
+#else
+	struct stat status;
+	return stat(i_filepath.c_str(), &status) == 0;
+#endif
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "CookedAsset.h"
+#include "ImportSession.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Headless cooker for a whole directory of fbx files.
+// Every fbx is cooked next to itself as <name>.cooked. A manifest in the directory remembers
+// the content hash of each input and the importer and cooked file versions and the vertex and clip format it was cooked with, so only new or changed files are imported again.
+class BatchCooker
+{
+public:
+	static const char* ManifestName;
+
+	struct ManifestEntry
+	{
+		std::string file;
+		uint64_t    hash;
+		uint32_t    version;       // CookedData::ImporterVersion
+		uint32_t    cookedversion; // CookedData::Version
+		uint32_t    format;
+		uint32_t    clipformat;
+	};
+
+	// Cook every fbx in the directory on the thread pool, returns false when any of them failed
+	static bool CookDirectory(const char* i_directory, CookedData::VertexFormat i_format = CookedData::VertexFormat::Full, ClipFormat i_clipformat = ClipFormat::Float);
+
+	// Import one fbx with everything it contains and write it to a cooked file
+	static bool CookFile(const std::string& i_fbxpath, const std::string& i_cookedpath, CookedData::VertexFormat i_format = CookedData::VertexFormat::Full, ClipFormat i_clipformat = ClipFormat::Float);
+
+	// Optimize a file an import session has loaded and write it to a cooked file
+	static bool CookImported(ImportedFile& io_file, const std::string& i_cookedpath, CookedData::VertexFormat i_format = CookedData::VertexFormat::Full, ClipFormat i_clipformat = ClipFormat::Float);
+
+	// 64 bit FNV-1a of the file content
+	static bool HashFile(const std::string& i_filepath, uint64_t& o_hash);
+
+	static bool ReadManifest(const std::string& i_filepath, std::vector<ManifestEntry>& o_entries);
+	static bool WriteManifest(const std::string& i_filepath, const std::vector<ManifestEntry>& i_entries);
+
+	// Names of the fbx files in a directory ending in a slash, sorted
+	static bool ListFbxFiles(const std::string& i_directory, std::vector<std::string>& o_files);
+
+private:
+	static bool FileExists(const std::string& i_filepath);
+};
@@ -0,0 +1,381 @@
+#include "ClipBitRate.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace
+{
+	bool HasBit(const uint32_t* i_bits, int i_joint)
+	{
+		return ((i_bits[i_joint / 32] >> (i_joint % 32)) & 1) != 0;
+	}
+
+	void WriteBits(std::vector<uint32_t>& io_words, size_t i_bit, uint64_t i_value, int i_count)
+	{
+		for (int written = 0; written < i_count;)
+		{
+			const size_t bit = i_bit + written;
+			const int shift = static_cast<int>(bit & 31);
+			const int take = std::min(32 - shift, i_count - written);
+			const uint32_t mask = take == 32 ? ~0u : (1u << take) - 1;
+			io_words[bit >> 5] |= (static_cast<uint32_t>(i_value >> written) & mask) << shift;
+			written += take;
+		}
+	}
+
+	// Bits a rotation, translation or scale track takes in a frame
+	int TrackBits(int i_channel, int i_bits)
+	{
+		return i_channel == ClipTracks::Rotation ? 2 + 3 * i_bits : (i_channel == ClipTracks::Translation ? 3 * i_bits : i_bits);
+	}
+
+	// What the sampler decodes from a track stored in i_bits, 0 keeps the value as it is
+	glm::quat Decoded(const glm::quat& i_rotation, int i_bits)
+	{
+		return i_bits ? ClipCompressor::UnpackRotation(ClipCompressor::PackRotation(i_rotation, i_bits), i_bits) : i_rotation;
+	}
+
+	glm::vec3 Decoded(const glm::vec3& i_translation, const TrackRange& i_range, int i_bits)
+	{
+		glm::vec3 translation = i_translation;
+		for (int axis = 0; axis < 3 && i_bits; axis++)
+		{
+			const float extent = i_range.translation_extent[axis];
+			const uint32_t packed = extent > 0.0f ? ClipCompressor::PackUnorm((i_translation[axis] - i_range.translation_min[axis]) / extent, i_bits) : 0;
+			translation[axis] = i_range.translation_min[axis] + extent * ClipCompressor::UnpackUnorm(packed, i_bits);
+		}
+		return translation;
+	}
+
+	float Decoded(float i_scale, const TrackRange& i_range, int i_bits)
+	{
+		if (!i_bits)
+		{
+			return i_scale;
+		}
+		const uint32_t packed = i_range.scale_extent > 0.0f ? ClipCompressor::PackUnorm((i_scale - i_range.scale_min) / i_range.scale_extent, i_bits) : 0;
+		return i_range.scale_min + i_range.scale_extent * ClipCompressor::UnpackUnorm(packed, i_bits);
+	}
+}
+
+bool ClipBitRate::Compress(const AnimationClip& i_clip, const Skeleton* i_skeleton, VariableClipPoses& o_poses, ClipBitRateReport& o_report,
+	const ClipBitRateSettings& i_settings)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const ClipPoses& poses = i_clip.poses;
+	const int frames = poses.frame_count;
+	const int joints = poses.joint_count;
+	const size_t count = static_cast<size_t>(frames) * joints;
+
+	o_poses = VariableClipPoses();
+	o_report = ClipBitRateReport();
+	if (frames < 0 || joints < 0 || poses.rotations.size() != count || poses.translations.size() != count || poses.scales.size() != count
+		|| poses.parent_index.size() != static_cast<size_t>(joints))
+	{
+		return false;
+	}
+	// Joints are searched from the root down, so every parent has to come first
+	for (int j = 0; j < joints; j++)
+	{
+		if (poses.parent_index[j] >= j)
+		{
+			return false;
+		}
+	}
+
+	o_poses.frame_count = frames;
+	o_poses.joint_count = joints;
+	o_poses.parent_index = poses.parent_index;
+	o_report.tracks = ClipCompressor::ClassifyTracks(i_clip, i_skeleton, o_poses.layout);
+	const uint32_t* bits = o_poses.layout.bits.data();
+
+	// Model space transforms of the original poses
+	std::vector<glm::mat4> globals(count);
+	for (int f = 0; f < frames; f++)
+	{
+		const size_t first = poses.Index(f, 0);
+		ClipSampler::LocalToModel(poses.parent_index.data(), joints, &poses.rotations[first], &poses.translations[first], &poses.scales[first], &globals[first]);
+	}
+
+	// A parent's virtual vertices reach as far as its children, so its error is measured where the children will be
+	std::vector<float> reach(joints, 0.0f);
+	if (frames > 0)
+	{
+		for (int j = 0; j < joints; j++)
+		{
+			glm::vec3 position(globals[poses.Index(0, j)][3]);
+			for (int parent = poses.parent_index[j]; parent >= 0; parent = poses.parent_index[parent])
+			{
+				reach[parent] = std::max(reach[parent], glm::length(position - glm::vec3(globals[poses.Index(0, parent)][3])));
+			}
+		}
+	}
+
+	// Depth from the root and the longest chain below every joint, parents come first
+	std::vector<int> depth(joints, 0);
+	std::vector<int> height(joints, 0);
+	std::vector<std::vector<int>> levels;
+	for (int j = 0; j < joints; j++)
+	{
+		const int parent = poses.parent_index[j];
+		depth[j] = parent >= 0 ? depth[parent] + 1 : 0;
+		if (depth[j] >= static_cast<int>(levels.size()))
+		{
+			levels.resize(depth[j] + 1);
+		}
+		levels[depth[j]].push_back(j);
+	}
+	for (int j = joints - 1; j >= 0; j--)
+	{
+		const int parent = poses.parent_index[j];
+		if (parent >= 0)
+		{
+			height[parent] = std::max(height[parent], height[j] + 1);
+		}
+	}
+
+	o_poses.ranges.resize(joints);
+	for (int j = 0; j < joints; j++)
+	{
+		o_poses.ranges[j] = ClipCompressor::Range(poses, j);
+	}
+
+	// Bits a component of every channel of every joint, 0 for tracks that are not animated
+	std::vector<int> rates(static_cast<size_t>(joints) * 3, 0);
+	std::vector<glm::mat4> compressed(count);
+	std::vector<float> largestErrors(joints, 0.0f);
+	std::vector<double> errorSums(joints, 0.0);
+
+	auto search = [&](int j)
+	{
+		const int parent = poses.parent_index[j];
+		const TrackRange& range = o_poses.ranges[j];
+
+		// The error a joint's own tracks may add to what its parents already have
+		const float budget = i_settings.tolerance * (depth[j] + 1) / static_cast<float>(depth[j] + 1 + height[j]);
+
+		// Virtual vertices in the joint's space, scaled so they are the same model space distance away in every frame
+		float distance = i_settings.shell_distance + reach[j];
+		float bindScale = frames > 0 ? glm::length(glm::vec3(globals[poses.Index(0, j)][0])) : 1.0f;
+		float offset = bindScale > 0.0f ? distance / bindScale : distance;
+		const glm::vec4 vertices[3] = { glm::vec4(offset, 0.0f, 0.0f, 1.0f), glm::vec4(0.0f, offset, 0.0f, 1.0f), glm::vec4(0.0f, 0.0f, offset, 1.0f) };
+
+		auto global = [&](int f, const int* i_bits)
+		{
+			const size_t pose = poses.Index(f, j);
+			glm::mat4 local = ClipSampler::ComposePose(Decoded(poses.rotations[pose], i_bits[ClipTracks::Rotation]),
+				Decoded(poses.translations[pose], range, i_bits[ClipTracks::Translation]), Decoded(poses.scales[pose], range, i_bits[ClipTracks::Scale]));
+			return parent >= 0 ? compressed[poses.Index(f, parent)] * local : local;
+		};
+		auto frameError = [&](int f, const glm::mat4& i_global)
+		{
+			const glm::mat4& original = globals[poses.Index(f, j)];
+			float largest = 0.0f;
+			for (const glm::vec4& vertex : vertices)
+			{
+				largest = std::max(largest, glm::length(glm::vec3(i_global * vertex) - glm::vec3(original * vertex)));
+			}
+			return largest;
+		};
+		auto error = [&](const int* i_bits)
+		{
+			float largest = 0.0f;
+			for (int f = 0; f < frames && largest <= budget; f++)
+			{
+				largest = std::max(largest, frameError(f, global(f, i_bits)));
+			}
+			return largest;
+		};
+
+		// Every channel on its own first, with the others left as they are
+		int* chosen = &rates[static_cast<size_t>(j) * 3];
+		bool animated[3];
+		for (int channel = 0; channel < 3; channel++)
+		{
+			animated[channel] = HasBit(ClipTracks::Animated(bits, joints, channel), j);
+			if (!animated[channel])
+			{
+				continue;
+			}
+
+			int trial[3] = {};
+			for (trial[channel] = LowestBits; trial[channel] < HighestBits && error(trial) > budget; trial[channel]++)
+			{
+			}
+			chosen[channel] = trial[channel];
+		}
+
+		// Then together, the channel that helps most gets another bit until they fit
+		for (float current = error(chosen); current > budget;)
+		{
+			int best = -1;
+			float bestError = current;
+			for (int channel = 0; channel < 3; channel++)
+			{
+				if (!animated[channel] || chosen[channel] >= HighestBits)
+				{
+					continue;
+				}
+				chosen[channel]++;
+				float trial = error(chosen);
+				chosen[channel]--;
+				if (best < 0 || trial < bestError)
+				{
+					best = channel;
+					bestError = trial;
+				}
+			}
+			if (best < 0)
+			{
+				break;
+			}
+			chosen[best]++;
+			current = bestError;
+		}
+
+		for (int f = 0; f < frames; f++)
+		{
+			const glm::mat4 result = global(f, chosen);
+			const float frameLargest = frameError(f, result);
+			largestErrors[j] = std::max(largestErrors[j], frameLargest);
+			errorSums[j] += frameLargest;
+			compressed[poses.Index(f, j)] = result;
+		}
+	};
+
+	// A joint only depends on its parents, so the joints of a depth can be searched side by side
+	for (const std::vector<int>& level : levels)
+	{
+		ThreadPool::Get().ParallelFor(0, static_cast<int>(level.size()), [&](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				search(level[i]);
+			}
+		});
+	}
+
+	// Constant tracks once, then the bit rates and frames of the animated tracks channel by channel in joint order
+	int frameBits = 0;
+	for (int channel = 0; channel < 3; channel++)
+	{
+		for (int j = 0; j < joints; j++)
+		{
+			const size_t pose = poses.Index(0, j);
+			if (frames > 0 && HasBit(ClipTracks::Constant(bits, joints, channel), j))
+			{
+				switch (channel)
+				{
+				case ClipTracks::Rotation:
+					o_poses.constant_rotations.push_back(poses.rotations[pose]);
+					break;
+				case ClipTracks::Translation:
+					o_poses.constant_translations.push_back(poses.translations[pose]);
+					break;
+				default:
+					o_poses.constant_scales.push_back(poses.scales[pose]);
+					break;
+				}
+			}
+			if (HasBit(ClipTracks::Animated(bits, joints, channel), j))
+			{
+				const int rate = rates[static_cast<size_t>(j) * 3 + channel];
+				o_poses.bit_rates.push_back(static_cast<uint8_t>(rate));
+				frameBits += TrackBits(channel, rate);
+			}
+		}
+	}
+
+	o_poses.frame_words = static_cast<uint32_t>((frameBits + 31) / 32);
+	o_poses.frames.assign(static_cast<size_t>(frames) * o_poses.frame_words + 1, 0);
+	for (int f = 0; f < frames; f++)
+	{
+		size_t bit = static_cast<size_t>(f) * o_poses.frame_words * 32;
+		for (int channel = 0; channel < 3; channel++)
+		{
+			for (int j = 0; j < joints; j++)
+			{
+				if (!HasBit(ClipTracks::Animated(bits, joints, channel), j))
+				{
+					continue;
+				}
+
+				const int rate = rates[static_cast<size_t>(j) * 3 + channel];
+				const size_t pose = poses.Index(f, j);
+				const TrackRange& range = o_poses.ranges[j];
+				if (channel == ClipTracks::Rotation)
+				{
+					WriteBits(o_poses.frames, bit, ClipCompressor::PackRotation(poses.rotations[pose], rate), TrackBits(channel, rate));
+				}
+				else if (channel == ClipTracks::Translation)
+				{
+					for (int axis = 0; axis < 3; axis++)
+					{
+						const float extent = range.translation_extent[axis];
+						WriteBits(o_poses.frames, bit + axis * rate, extent > 0.0f ? ClipCompressor::PackUnorm((poses.translations[pose][axis] - range.translation_min[axis]) / extent, rate) : 0, rate);
+					}
+				}
+				else
+				{
+					WriteBits(o_poses.frames, bit, range.scale_extent > 0.0f ? ClipCompressor::PackUnorm((poses.scales[pose] - range.scale_min) / range.scale_extent, rate) : 0, rate);
+				}
+				bit += TrackBits(channel, rate);
+			}
+		}
+	}
+
+	double errorSum = 0.0;
+	for (int j = 0; j < joints; j++)
+	{
+		o_report.largest_error = std::max(o_report.largest_error, largestErrors[j]);
+		errorSum += errorSums[j];
+	}
+	o_report.average_error = count ? static_cast<float>(errorSum / count) : 0.0f;
+	o_report.float_bytes = count * (sizeof(glm::quat) + sizeof(glm::vec3) + sizeof(float));
+	o_report.bytes = o_poses.layout.bits.size() * sizeof(uint32_t) + o_poses.ranges.size() * sizeof(TrackRange)
+		+ o_poses.constant_rotations.size() * sizeof(glm::quat) + o_poses.constant_translations.size() * sizeof(glm::vec3) + o_poses.constant_scales.size() * sizeof(float)
+		+ o_poses.bit_rates.size() + o_poses.frames.size() * sizeof(uint32_t);
+	o_report.average_bits = o_poses.bit_rates.empty() ? 0.0f : static_cast<float>(frameBits) / o_poses.bit_rates.size();
+	o_report.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return true;
+}
+
+void ClipBitRate::Print(const AnimationClip& i_clip, const ClipBitRateReport& i_report)
+{
+	ClipCompressor::PrintTracks(i_clip, i_report.tracks);
+	printf("%s: %zu bytes of poses compressed to %zu (%.1fx) at %.1f bits a track, largest error %g, average %g, %.1f ms\n", i_clip.name.c_str(),
+		i_report.float_bytes, i_report.bytes, i_report.bytes ? static_cast<double>(i_report.float_bytes) / i_report.bytes : 0.0,
+		i_report.average_bits, i_report.largest_error, i_report.average_error, i_report.milliseconds);
+}
+
+ClipView ClipBitRate::View(const VariableClipPoses& i_poses, bool i_looping)
+{
+	ClipView view;
+	view.frame_count = i_poses.frame_count;
+	view.joint_count = i_poses.joint_count;
+	view.is_looping = i_looping;
+	view.parent_index = i_poses.parent_index.data();
+	view.format = ClipFormat::Variable;
+	view.track_bits = i_poses.layout.bits.data();
+	for (int channel = 0; channel < 3; channel++)
+	{
+		view.animated_count[channel] = i_poses.layout.animated_count[channel];
+		view.constant_count[channel] = i_poses.layout.constant_count[channel];
+	}
+	view.rotations = i_poses.constant_rotations.data();
+	view.translations = i_poses.constant_translations.data();
+	view.scales = i_poses.constant_scales.data();
+	view.ranges = i_poses.ranges.data();
+	view.packed_rotations = nullptr;
+	view.packed_translations = nullptr;
+	view.packed_scales = nullptr;
+	view.bit_rates = i_poses.bit_rates.data();
+	view.packed_frames = i_poses.frames.data();
+	view.frame_words = i_poses.frame_words;
+	view.keyed_joints = nullptr;
+	view.rotation_frames = nullptr;
+	view.translation_frames = nullptr;
+	view.scale_frames = nullptr;
+	return view;
+}
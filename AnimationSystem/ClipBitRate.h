@@ -0,0 +1,61 @@
+#pragma once
+#include "ClipCompressor.h"
+
+// Error bound of ClipBitRate, measured like the one of ClipReducer
+struct ClipBitRateSettings
+{
+	// Largest distance a virtual vertex may move, in model units
+	float tolerance = 0.01f;
+	// Virtual vertices sit on the three axes of a joint, this far out plus the reach of its children
+	float shell_distance = 3.0f;
+};
+
+// Poses of a clip in ClipFormat::Variable, laid out the way ClipView describes it
+struct VariableClipPoses
+{
+	int                     frame_count = 0;
+	int                     joint_count = 0;
+	std::vector<int>        parent_index;
+	ClipTrackLayout         layout;
+	std::vector<TrackRange> ranges;                // one per joint
+	std::vector<glm::quat>  constant_rotations;    // the constant tracks in joint order
+	std::vector<glm::vec3>  constant_translations;
+	std::vector<float>      constant_scales;
+	std::vector<uint8_t>    bit_rates;             // one per animated track
+	std::vector<uint32_t>   frames;                // frame_words a frame, then one word of padding
+	uint32_t                frame_words = 0;
+};
+
+// Size, error and time of one compressed clip
+struct ClipBitRateReport
+{
+	size_t float_bytes = 0;      // every pose in floats
+	size_t bytes = 0;            // track bits, ranges, constant tracks, bit rates and frames
+	float  largest_error = 0.0f; // at the virtual vertices, in model units
+	float  average_error = 0.0f; // of the largest error of every joint and frame
+	float  average_bits = 0.0f;  // a component of every animated track
+	double milliseconds = 0.0;
+	ClipTrackReport tracks;
+};
+
+// Picks the fewest bits a component for every animated track that keep the virtual vertices of ClipReducer within the tolerance.
+// Joints are searched from the root down against the compressed transforms of their parents, so errors down a chain add up.
+// A joint gets a share of the tolerance that grows with its depth, which leaves room for the joints below it,
+// and the joints of one depth are searched in parallel on the thread pool.
+class ClipBitRate
+{
+public:
+	static const int LowestBits = 3;
+	static const int HighestBits = 16;
+
+	// Compress i_clip.poses and report how much smaller and how far off they are, without printing so clips can be compressed side by side.
+	// With the skeleton the clip is remapped to, tracks holding the bind pose are left out.
+	// Fails when the pose channels do not match the frame and joint count or a joint comes before its parent.
+	static bool Compress(const AnimationClip& i_clip, const Skeleton* i_skeleton, VariableClipPoses& o_poses, ClipBitRateReport& o_report,
+		const ClipBitRateSettings& i_settings = ClipBitRateSettings());
+
+	// The track counts and one line with the report of a compressed clip
+	static void Print(const AnimationClip& i_clip, const ClipBitRateReport& i_report);
+
+	static ClipView View(const VariableClipPoses& i_poses, bool i_looping);
+};
@@ -0,0 +1,347 @@
+#include "ClipCompressor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace
+{
+	// The three smallest components of a unit quaternion are within +-1/sqrt(2)
+	const float SmallestThreeRange = 0.70710678f;
+
+	uint16_t ToUnorm16(float i_value)
+	{
+		return static_cast<uint16_t>(std::round(std::min(std::max(i_value, 0.0f), 1.0f) * 65535.0f));
+	}
+
+	int RotationBits(ClipFormat i_format)
+	{
+		return i_format == ClipFormat::Quantized32 ? 10 : 15;
+	}
+
+	// Tracks closer than this are the same, relative to the size of the value
+	const float SameTrackTolerance = 1e-5f;
+
+	bool Same(const glm::quat& i_a, const glm::quat& i_b)
+	{
+		return glm::length(glm::dot(i_a, i_b) < 0.0f ? i_a + i_b : i_a - i_b) <= SameTrackTolerance;
+	}
+
+	bool Same(const glm::vec3& i_a, const glm::vec3& i_b)
+	{
+		return glm::length(i_a - i_b) <= SameTrackTolerance * std::max(1.0f, glm::length(i_a));
+	}
+
+	bool Same(float i_a, float i_b)
+	{
+		return std::fabs(i_a - i_b) <= SameTrackTolerance * std::max(1.0f, std::fabs(i_a));
+	}
+
+	enum class TrackKind
+	{
+		Animated,
+		Constant,
+		Bind,
+	};
+
+	template <class Value>
+	TrackKind Classify(const ClipPoses& i_poses, const std::vector<Value>& i_values, int i_joint, const Value* i_bind)
+	{
+		for (int f = 1; f < i_poses.frame_count; f++)
+		{
+			if (!Same(i_values[i_poses.Index(0, i_joint)], i_values[i_poses.Index(f, i_joint)]))
+			{
+				return TrackKind::Animated;
+			}
+		}
+		return i_bind && i_poses.frame_count > 0 && Same(*i_bind, i_values[i_poses.Index(0, i_joint)]) ? TrackKind::Bind : TrackKind::Constant;
+	}
+}
+
+void ClipCompressor::BindPose(const Skeleton& i_skeleton, std::vector<glm::quat>& o_rotations, std::vector<glm::vec3>& o_translations, std::vector<float>& o_scales)
+{
+	const size_t count = i_skeleton.joints.size();
+	o_rotations.resize(count);
+	o_translations.resize(count);
+	o_scales.resize(count);
+	for (size_t j = 0; j < count; j++)
+	{
+		glm::mat4 local = glm::inverse(i_skeleton.joints[j].inversed);
+		int parent = i_skeleton.joints[j].parent_index;
+		if (parent >= 0)
+		{
+			local = i_skeleton.joints[parent].inversed * local;
+		}
+		ClipSampler::DecomposePose(local, o_rotations[j], o_translations[j], o_scales[j]);
+	}
+}
+
+ClipTrackReport ClipCompressor::ClassifyTracks(const AnimationClip& i_clip, const Skeleton* i_skeleton, ClipTrackLayout& o_layout)
+{
+	const ClipPoses& poses = i_clip.poses;
+	const int joints = poses.joint_count;
+	const int words = ClipTracks::Words(joints);
+
+	bool bind = i_skeleton && i_skeleton->joints.size() == static_cast<size_t>(joints);
+	for (int j = 0; j < joints && bind; j++)
+	{
+		bind = i_skeleton->joints[j].parent_index == poses.parent_index[j];
+	}
+	std::vector<glm::quat> bindRotations;
+	std::vector<glm::vec3> bindTranslations;
+	std::vector<float> bindScales;
+	if (bind)
+	{
+		BindPose(*i_skeleton, bindRotations, bindTranslations, bindScales);
+	}
+
+	o_layout.bits.assign(6 * words, 0);
+	int bindCount[3] = {};
+	for (int channel = 0; channel < 3; channel++)
+	{
+		o_layout.animated_count[channel] = 0;
+		o_layout.constant_count[channel] = 0;
+	}
+
+	for (int j = 0; j < joints; j++)
+	{
+		TrackKind kinds[3] =
+		{
+			Classify(poses, poses.rotations, j, bind ? &bindRotations[j] : nullptr),
+			Classify(poses, poses.translations, j, bind ? &bindTranslations[j] : nullptr),
+			Classify(poses, poses.scales, j, bind ? &bindScales[j] : nullptr),
+		};
+		for (int channel = 0; channel < 3; channel++)
+		{
+			const uint32_t bit = 1u << (j % 32);
+			switch (kinds[channel])
+			{
+			case TrackKind::Animated:
+				o_layout.bits[channel * words + j / 32] |= bit;
+				o_layout.animated_count[channel]++;
+				break;
+			case TrackKind::Constant:
+				o_layout.bits[(3 + channel) * words + j / 32] |= bit;
+				o_layout.constant_count[channel]++;
+				break;
+			case TrackKind::Bind:
+				bindCount[channel]++;
+				break;
+			}
+		}
+	}
+
+	ClipTrackReport report;
+	for (int channel = 0; channel < 3; channel++)
+	{
+		report.animated_count[channel] = o_layout.animated_count[channel];
+		report.constant_count[channel] = o_layout.constant_count[channel];
+		report.bind_count[channel] = bindCount[channel];
+	}
+	return report;
+}
+
+void ClipCompressor::PrintTracks(const AnimationClip& i_clip, const ClipTrackReport& i_report)
+{
+	printf("%s: animated, constant and bind pose tracks: rotation %d %d %d, translation %d %d %d, scale %d %d %d\n", i_clip.name.c_str(),
+		i_report.animated_count[0], i_report.constant_count[0], i_report.bind_count[0],
+		i_report.animated_count[1], i_report.constant_count[1], i_report.bind_count[1],
+		i_report.animated_count[2], i_report.constant_count[2], i_report.bind_count[2]);
+}
+
+void ClipCompressor::EncodeRotation(const glm::quat& i_rotation, ClipFormat i_format, uint16_t* o_words)
+{
+	const uint64_t packed = PackRotation(i_rotation, RotationBits(i_format));
+	const size_t words = RotationWords(i_format);
+	for (size_t i = 0; i < words; i++)
+	{
+		o_words[i] = static_cast<uint16_t>(packed >> (16 * i));
+	}
+}
+
+glm::quat ClipCompressor::DecodeRotation(const uint16_t* i_words, ClipFormat i_format)
+{
+	uint64_t packed = 0;
+	const size_t words = RotationWords(i_format);
+	for (size_t i = 0; i < words; i++)
+	{
+		packed |= static_cast<uint64_t>(i_words[i]) << (16 * i);
+	}
+	return UnpackRotation(packed, RotationBits(i_format));
+}
+
+uint64_t ClipCompressor::PackRotation(const glm::quat& i_rotation, int i_bits)
+{
+	const float steps = static_cast<float>((1u << i_bits) - 1);
+
+	glm::quat rotation = glm::normalize(i_rotation);
+	int largest = 0;
+	for (int i = 1; i < 4; i++)
+	{
+		if (std::fabs(rotation[i]) > std::fabs(rotation[largest]))
+		{
+			largest = i;
+		}
+	}
+	// q and -q are the same rotation, the dropped component is kept positive so its sign needs no bit
+	if (rotation[largest] < 0.0f)
+	{
+		rotation = -rotation;
+	}
+
+	uint64_t packed = static_cast<uint64_t>(largest);
+	int shift = 2;
+	for (int i = 0; i < 4; i++)
+	{
+		if (i == largest)
+		{
+			continue;
+		}
+		float value = (rotation[i] / SmallestThreeRange + 1.0f) * 0.5f;
+		value = std::min(std::max(value, 0.0f), 1.0f);
+		packed |= static_cast<uint64_t>(std::round(value * steps)) << shift;
+		shift += i_bits;
+	}
+	return packed;
+}
+
+glm::quat ClipCompressor::UnpackRotation(uint64_t i_packed, int i_bits)
+{
+	const uint64_t mask = (1u << i_bits) - 1;
+	const float scale = 2.0f * SmallestThreeRange / static_cast<float>(mask);
+
+	const int largest = static_cast<int>(i_packed & 3);
+	glm::quat rotation;
+	float sum = 0.0f;
+	int shift = 2;
+	for (int i = 0; i < 4; i++)
+	{
+		if (i == largest)
+		{
+			continue;
+		}
+		float value = static_cast<float>((i_packed >> shift) & mask) * scale - SmallestThreeRange;
+		rotation[i] = value;
+		sum += value * value;
+		shift += i_bits;
+	}
+	rotation[largest] = std::sqrt(std::max(1.0f - sum, 0.0f));
+	return rotation;
+}
+
+void ClipCompressor::Quantize(const AnimationClip& i_clip, ClipFormat i_format, QuantizedClipPoses& o_poses)
+{
+	const ClipPoses& poses = i_clip.poses;
+	const size_t count = static_cast<size_t>(poses.frame_count) * poses.joint_count;
+	const size_t words = RotationWords(i_format);
+
+	o_poses.format = i_format;
+	o_poses.frame_count = poses.frame_count;
+	o_poses.joint_count = poses.joint_count;
+	o_poses.parent_index = poses.parent_index;
+	o_poses.ranges.resize(poses.joint_count);
+	o_poses.rotations.resize(count * words);
+	o_poses.translations.resize(count * 3);
+	o_poses.scales.resize(count);
+
+	for (int j = 0; j < poses.joint_count; j++)
+	{
+		const TrackRange& range = o_poses.ranges[j] = Range(poses, j);
+
+		// A constant channel encodes as zero
+		for (int f = 0; f < poses.frame_count; f++)
+		{
+			size_t pose = poses.Index(f, j);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float extent = range.translation_extent[axis];
+				o_poses.translations[pose * 3 + axis] = extent > 0.0f ? ToUnorm16((poses.translations[pose][axis] - range.translation_min[axis]) / extent) : 0;
+			}
+			o_poses.scales[pose] = range.scale_extent > 0.0f ? ToUnorm16((poses.scales[pose] - range.scale_min) / range.scale_extent) : 0;
+			EncodeRotation(poses.rotations[pose], i_format, &o_poses.rotations[pose * words]);
+		}
+	}
+
+	// Largest error of any pose, rotations as the angle between the original and the decoded one
+	float rotationError = 0.0f;
+	float translationError = 0.0f;
+	float scaleError = 0.0f;
+	for (size_t pose = 0; pose < count; pose++)
+	{
+		const TrackRange& range = o_poses.ranges[pose % poses.joint_count];
+		// From the chord between the two, acos of their dot product is too coarse in floats for angles this small
+		glm::quat rotation = DecodeRotation(&o_poses.rotations[pose * words], i_format);
+		glm::quat original = glm::normalize(poses.rotations[pose]);
+		if (glm::dot(rotation, original) < 0.0f)
+		{
+			original = -original;
+		}
+		float chord = std::min(glm::length(rotation - original) * 0.5f, 1.0f);
+		rotationError = std::max(rotationError, 4.0f * std::asin(chord));
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float translation = range.translation_min[axis] + range.translation_extent[axis] * o_poses.translations[pose * 3 + axis] / 65535.0f;
+			translationError = std::max(translationError, std::fabs(translation - poses.translations[pose][axis]));
+		}
+		float scale = range.scale_min + range.scale_extent * o_poses.scales[pose] / 65535.0f;
+		scaleError = std::max(scaleError, std::fabs(scale - poses.scales[pose]));
+	}
+
+	const size_t floatBytes = count * (sizeof(glm::quat) + sizeof(glm::vec3) + sizeof(float));
+	const size_t quantizedBytes = (o_poses.rotations.size() + o_poses.translations.size() + o_poses.scales.size()) * sizeof(uint16_t)
+		+ o_poses.ranges.size() * sizeof(TrackRange);
+	printf("%s: %zu bytes of poses quantized to %zu (%.1fx), largest error %.4f degrees, %g translation, %g scale\n", i_clip.name.c_str(),
+		floatBytes, quantizedBytes, quantizedBytes ? static_cast<double>(floatBytes) / quantizedBytes : 0.0,
+		glm::degrees(rotationError), translationError, scaleError);
+}
+
+ClipView ClipCompressor::View(const QuantizedClipPoses& i_poses, bool i_looping)
+{
+	ClipView view;
+	view.frame_count = i_poses.frame_count;
+	view.joint_count = i_poses.joint_count;
+	view.is_looping = i_looping;
+	view.parent_index = i_poses.parent_index.data();
+	view.format = i_poses.format;
+	view.track_bits = nullptr;
+	for (int channel = 0; channel < 3; channel++)
+	{
+		view.animated_count[channel] = i_poses.joint_count;
+		view.constant_count[channel] = 0;
+	}
+	view.rotations = nullptr;
+	view.translations = nullptr;
+	view.scales = nullptr;
+	view.ranges = i_poses.ranges.data();
+	view.packed_rotations = i_poses.rotations.data();
+	view.packed_translations = i_poses.translations.data();
+	view.packed_scales = i_poses.scales.data();
+	view.bit_rates = nullptr;
+	view.packed_frames = nullptr;
+	view.frame_words = 0;
+	view.keyed_joints = nullptr;
+	view.rotation_frames = nullptr;
+	view.translation_frames = nullptr;
+	view.scale_frames = nullptr;
+	return view;
+}
+
+TrackRange ClipCompressor::Range(const ClipPoses& i_poses, int i_joint)
+{
+	glm::vec3 translationMin(0.0f), translationMax(0.0f);
+	float scaleMin = 0.0f, scaleMax = 0.0f;
+	for (int f = 0; f < i_poses.frame_count; f++)
+	{
+		size_t pose = i_poses.Index(f, i_joint);
+		translationMin = f ? glm::min(translationMin, i_poses.translations[pose]) : i_poses.translations[pose];
+		translationMax = f ? glm::max(translationMax, i_poses.translations[pose]) : i_poses.translations[pose];
+		scaleMin = f ? std::min(scaleMin, i_poses.scales[pose]) : i_poses.scales[pose];
+		scaleMax = f ? std::max(scaleMax, i_poses.scales[pose]) : i_poses.scales[pose];
+	}
+
+	TrackRange range;
+	range.translation_min = translationMin;
+	range.translation_extent = translationMax - translationMin;
+	range.scale_min = scaleMin;
+	range.scale_extent = scaleMax - scaleMin;
+	return range;
+}
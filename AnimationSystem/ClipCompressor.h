@@ -0,0 +1,81 @@
+#pragma once
+#include "ClipSampler.h"
+#include <algorithm>
+#include <cmath>
+
+// Poses of a clip in one of the quantized formats, laid out [frame][joint] like ClipPoses
+struct QuantizedClipPoses
+{
+	ClipFormat              format = ClipFormat::Quantized48;
+	int                     frame_count = 0;
+	int                     joint_count = 0;
+	std::vector<int>        parent_index;
+	std::vector<TrackRange> ranges;       // one per joint
+	std::vector<uint16_t>   rotations;    // RotationWords a pose
+	std::vector<uint16_t>   translations; // three a pose
+	std::vector<uint16_t>   scales;
+};
+
+// Which tracks of a clip change, laid out like ClipView::track_bits
+struct ClipTrackLayout
+{
+	std::vector<uint32_t> bits;
+	int                   animated_count[3];
+	int                   constant_count[3];
+};
+
+// How many tracks of each kind ClassifyTracks found, by channel
+struct ClipTrackReport
+{
+	int animated_count[3] = {};
+	int constant_count[3] = {};
+	int bind_count[3] = {};
+};
+
+class ClipCompressor
+{
+public:
+	// Sort every track of a clip into animated, constant or holding the bind pose, and report how many there are of each.
+	// Bind pose tracks are only found when the clip is in the skeleton's joint order.
+	static ClipTrackReport ClassifyTracks(const AnimationClip& i_clip, const Skeleton* i_skeleton, ClipTrackLayout& o_layout);
+
+	// One line with the track counts of a clip
+	static void PrintTracks(const AnimationClip& i_clip, const ClipTrackReport& i_report);
+
+	// Local bind pose of every joint of a skeleton
+	static void BindPose(const Skeleton& i_skeleton, std::vector<glm::quat>& o_rotations, std::vector<glm::vec3>& o_translations, std::vector<float>& o_scales);
+
+	// Quantize the poses of a clip and print how much smaller and how far off they are
+	static void Quantize(const AnimationClip& i_clip, ClipFormat i_format, QuantizedClipPoses& o_poses);
+
+	static ClipView View(const QuantizedClipPoses& i_poses, bool i_looping);
+
+	// 16 bit words of one rotation, 3 for Quantized48 and 2 for Quantized32
+	static size_t RotationWords(ClipFormat i_format)
+	{
+		return i_format == ClipFormat::Quantized32 ? 2 : 3;
+	}
+
+	// Smallest three: the index of the largest component in 2 bits and the other three in 15 or 10 bits each.
+	// The largest one is rebuilt from the unit length.
+	static void EncodeRotation(const glm::quat& i_rotation, ClipFormat i_format, uint16_t* o_words);
+	static glm::quat DecodeRotation(const uint16_t* i_words, ClipFormat i_format);
+
+	// Smallest three with any number of bits a component up to 20, in the low 2 + 3 * i_bits bits
+	static uint64_t PackRotation(const glm::quat& i_rotation, int i_bits);
+	static glm::quat UnpackRotation(uint64_t i_packed, int i_bits);
+
+	// A value between 0 and 1 in i_bits bits
+	static uint32_t PackUnorm(float i_value, int i_bits)
+	{
+		const float steps = static_cast<float>((1u << i_bits) - 1);
+		return static_cast<uint32_t>(std::round(std::min(std::max(i_value, 0.0f), 1.0f) * steps));
+	}
+	static float UnpackUnorm(uint32_t i_value, int i_bits)
+	{
+		return static_cast<float>(i_value) / static_cast<float>((1u << i_bits) - 1);
+	}
+
+	// Range of the translations and scales of one joint over every frame
+	static TrackRange Range(const ClipPoses& i_poses, int i_joint);
+};
@@ -0,0 +1,299 @@
+#include "ClipReducer.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+	// Same blend as ClipSampler
+	glm::quat BlendRotation(const glm::quat& i_a, const glm::quat& i_b, float i_alpha)
+	{
+		const glm::quat b = glm::dot(i_a, i_b) < 0.0f ? -i_b : i_b;
+		return glm::normalize(i_a * (1.0f - i_alpha) + b * i_alpha);
+	}
+
+	// One channel of the joint being reduced, the values between kept keys are what the sampler will return
+	template <class Value>
+	struct Channel
+	{
+		std::vector<Value> original;
+		std::vector<Value> reconstructed;
+		std::vector<bool>  keep;
+	};
+
+	template <class Value, class Blend>
+	void Interpolate(Channel<Value>& io_channel, int i_first, int i_last, Blend i_blend)
+	{
+		for (int f = i_first + 1; f < i_last; f++)
+		{
+			float alpha = static_cast<float>(f - i_first) / (i_last - i_first);
+			io_channel.reconstructed[f] = i_blend(io_channel.original[i_first], io_channel.original[i_last], alpha);
+		}
+	}
+
+	// Sweep the keys front to back, a key goes when the frames it covered stay within the tolerance without it
+	template <class Value, class Blend, class Error>
+	void ReduceChannel(Channel<Value>& io_channel, float i_tolerance, Blend i_blend, Error i_error)
+	{
+		const int frames = static_cast<int>(io_channel.original.size());
+		int previous = 0;
+		std::vector<Value> saved;
+		for (int k = 1; k + 1 < frames; k++)
+		{
+			saved.assign(io_channel.reconstructed.begin() + previous + 1, io_channel.reconstructed.begin() + k + 1);
+			Interpolate(io_channel, previous, k + 1, i_blend);
+
+			bool fits = true;
+			for (int f = previous + 1; f <= k && fits; f++)
+			{
+				fits = i_error(f) <= i_tolerance;
+			}
+
+			if (fits)
+			{
+				io_channel.keep[k] = false;
+			}
+			else
+			{
+				std::copy(saved.begin(), saved.end(), io_channel.reconstructed.begin() + previous + 1);
+				previous = k;
+			}
+		}
+	}
+
+	template <class Value>
+	void AppendKeys(const Channel<Value>& i_channel, std::vector<float>& o_frames, std::vector<Value>& o_values, uint32_t& o_first, uint32_t& o_count)
+	{
+		o_first = static_cast<uint32_t>(o_values.size());
+		for (size_t f = 0; f < i_channel.keep.size(); f++)
+		{
+			if (i_channel.keep[f])
+			{
+				o_frames.push_back(static_cast<float>(f));
+				o_values.push_back(i_channel.original[f]);
+			}
+		}
+		o_count = static_cast<uint32_t>(o_values.size()) - o_first;
+	}
+}
+
+bool ClipReducer::Reduce(AnimationClip& io_clip, const Skeleton* i_skeleton, const ClipReductionSettings& i_settings)
+{
+	const ClipPoses& poses = io_clip.poses;
+	const int frames = poses.frame_count;
+	const int joints = poses.joint_count;
+	KeyedClipPoses& keys = io_clip.keys;
+	keys = KeyedClipPoses();
+
+	// Model space transforms of the original poses
+	std::vector<glm::mat4> globals(static_cast<size_t>(frames) * joints);
+	for (int f = 0; f < frames; f++)
+	{
+		for (int j = 0; j < joints; j++)
+		{
+			size_t pose = poses.Index(f, j);
+			glm::mat4 local = ClipSampler::ComposePose(poses.rotations[pose], poses.translations[pose], poses.scales[pose]);
+			int parent = poses.parent_index[j];
+			globals[pose] = parent >= 0 ? globals[poses.Index(f, parent)] * local : local;
+		}
+	}
+
+	// A parent's virtual vertices reach as far as its children, so its error is measured where the children will be
+	std::vector<float> reach(joints, 0.0f);
+	if (frames > 0)
+	{
+		for (int j = 0; j < joints; j++)
+		{
+			glm::vec3 position(globals[poses.Index(0, j)][3]);
+			for (int parent = poses.parent_index[j]; parent >= 0; parent = poses.parent_index[parent])
+			{
+				reach[parent] = std::max(reach[parent], glm::length(position - glm::vec3(globals[poses.Index(0, parent)][3])));
+			}
+		}
+	}
+
+	keys.frame_count = frames;
+	keys.joint_count = joints;
+	keys.joints.resize(joints);
+
+	// Only animated tracks are reduced, the others need one key or none
+	ClipTrackLayout layout;
+	ClipCompressor::PrintTracks(io_clip, ClipCompressor::ClassifyTracks(io_clip, i_skeleton, layout));
+	auto strip = [&](std::vector<bool>& io_keep, int i_joint, int i_channel)
+	{
+		const uint32_t bit = 1u << (i_joint % 32);
+		if (ClipTracks::Animated(layout.bits.data(), joints, i_channel)[i_joint / 32] & bit)
+		{
+			return false;
+		}
+		const bool constant = (ClipTracks::Constant(layout.bits.data(), joints, i_channel)[i_joint / 32] & bit) != 0;
+		io_keep.assign(frames, false);
+		if (constant && frames > 0)
+		{
+			io_keep[0] = true;
+		}
+		return true;
+	};
+
+	std::vector<glm::mat4> reduced(globals.size());
+	Channel<glm::quat> rotation;
+	Channel<glm::vec3> translation;
+	Channel<float> scale;
+	size_t keptKeys = 0;
+	float largestError = 0.0f;
+	for (int j = 0; j < joints; j++)
+	{
+		const int parent = poses.parent_index[j];
+
+		rotation.original.resize(frames);
+		translation.original.resize(frames);
+		scale.original.resize(frames);
+		for (int f = 0; f < frames; f++)
+		{
+			size_t pose = poses.Index(f, j);
+			rotation.original[f] = poses.rotations[pose];
+			translation.original[f] = poses.translations[pose];
+			scale.original[f] = poses.scales[pose];
+		}
+		rotation.reconstructed = rotation.original;
+		translation.reconstructed = translation.original;
+		scale.reconstructed = scale.original;
+		rotation.keep.assign(frames, true);
+		translation.keep.assign(frames, true);
+		scale.keep.assign(frames, true);
+
+		// Virtual vertices in the joint's space, scaled so they are the same model space distance away in every frame
+		float distance = i_settings.shell_distance + reach[j];
+		float bindScale = frames > 0 ? glm::length(glm::vec3(globals[poses.Index(0, j)][0])) : 1.0f;
+		float offset = bindScale > 0.0f ? distance / bindScale : distance;
+		const glm::vec4 vertices[3] = { glm::vec4(offset, 0.0f, 0.0f, 1.0f), glm::vec4(0.0f, offset, 0.0f, 1.0f), glm::vec4(0.0f, 0.0f, offset, 1.0f) };
+
+		auto error = [&](int f)
+		{
+			glm::mat4 local = ClipSampler::ComposePose(rotation.reconstructed[f], translation.reconstructed[f], scale.reconstructed[f]);
+			glm::mat4 global = parent >= 0 ? reduced[poses.Index(f, parent)] * local : local;
+			const glm::mat4& original = globals[poses.Index(f, j)];
+			float largest = 0.0f;
+			for (const glm::vec4& vertex : vertices)
+			{
+				largest = std::max(largest, glm::length(glm::vec3(global * vertex) - glm::vec3(original * vertex)));
+			}
+			return largest;
+		};
+
+		// Scale and translation keys are cheaper to lose than rotation keys, they go first
+		if (!strip(scale.keep, j, ClipTracks::Scale))
+		{
+			ReduceChannel(scale, i_settings.tolerance, [](float a, float b, float alpha) { return a + (b - a) * alpha; }, error);
+		}
+		if (!strip(translation.keep, j, ClipTracks::Translation))
+		{
+			ReduceChannel(translation, i_settings.tolerance, [](const glm::vec3& a, const glm::vec3& b, float alpha) { return a + (b - a) * alpha; }, error);
+		}
+		if (!strip(rotation.keep, j, ClipTracks::Rotation))
+		{
+			ReduceChannel(rotation, i_settings.tolerance, BlendRotation, error);
+		}
+
+		for (int f = 0; f < frames; f++)
+		{
+			largestError = std::max(largestError, error(f));
+			glm::mat4 local = ClipSampler::ComposePose(rotation.reconstructed[f], translation.reconstructed[f], scale.reconstructed[f]);
+			reduced[poses.Index(f, j)] = parent >= 0 ? reduced[poses.Index(f, parent)] * local : local;
+		}
+
+		KeyedJoint& joint = keys.joints[j];
+		AppendKeys(rotation, keys.rotation_frames, keys.rotations, joint.rotation_first, joint.rotation_count);
+		AppendKeys(translation, keys.translation_frames, keys.translations, joint.translation_first, joint.translation_count);
+		AppendKeys(scale, keys.scale_frames, keys.scales, joint.scale_first, joint.scale_count);
+		keptKeys += joint.rotation_count + joint.translation_count + joint.scale_count;
+	}
+
+	const size_t allKeys = static_cast<size_t>(frames) * joints * 3;
+	const size_t bytes = keys.rotations.size() * (sizeof(glm::quat) + sizeof(float)) + keys.translations.size() * (sizeof(glm::vec3) + sizeof(float))
+		+ keys.scales.size() * (sizeof(float) + sizeof(float)) + keys.joints.size() * sizeof(KeyedJoint);
+	printf("%s: %zu of %zu keys kept (%.1f%%), %zu bytes instead of %zu, largest error %g\n", io_clip.name.c_str(), keptKeys, allKeys,
+		allKeys ? 100.0 * keptKeys / allKeys : 0.0, bytes, poses.rotations.size() * (sizeof(glm::quat) + sizeof(glm::vec3) + sizeof(float)), largestError);
+	return true;
+}
+
+bool ClipReducer::KeysFromTracks(AnimationClip& io_clip)
+{
+	KeyedClipPoses& keys = io_clip.keys;
+	keys = KeyedClipPoses();
+	if (io_clip.tracks.size() != static_cast<size_t>(io_clip.poses.joint_count))
+	{
+		printf("%s has no curve keys for every joint\n", io_clip.name.c_str());
+		return false;
+	}
+
+	keys.frame_count = io_clip.frame_count;
+	keys.joint_count = io_clip.poses.joint_count;
+	keys.joints.resize(keys.joint_count);
+	const float framePerSecond = io_clip.frame_per_second;
+	for (int j = 0; j < keys.joint_count; j++)
+	{
+		const AnimationTrack& track = io_clip.tracks[j];
+		KeyedJoint& joint = keys.joints[j];
+
+		joint.rotation_first = static_cast<uint32_t>(keys.rotations.size());
+		joint.rotation_count = static_cast<uint32_t>(track.rotations.size());
+		for (float time : track.rotation_times)
+		{
+			keys.rotation_frames.push_back(time * framePerSecond);
+		}
+		keys.rotations.insert(keys.rotations.end(), track.rotations.begin(), track.rotations.end());
+
+		joint.translation_first = static_cast<uint32_t>(keys.translations.size());
+		joint.translation_count = static_cast<uint32_t>(track.translations.size());
+		for (float time : track.translation_times)
+		{
+			keys.translation_frames.push_back(time * framePerSecond);
+		}
+		keys.translations.insert(keys.translations.end(), track.translations.begin(), track.translations.end());
+
+		// Scales are uniform like the ones of resampled poses
+		joint.scale_first = static_cast<uint32_t>(keys.scales.size());
+		joint.scale_count = static_cast<uint32_t>(track.scales.size());
+		for (size_t k = 0; k < track.scales.size(); k++)
+		{
+			keys.scale_frames.push_back(track.scale_times[k] * framePerSecond);
+			keys.scales.push_back(track.scales[k].x);
+		}
+	}
+
+	printf("%s: %zu curve keys kept at their own times\n", io_clip.name.c_str(), keys.rotations.size() + keys.translations.size() + keys.scales.size());
+	return true;
+}
+
+ClipView ClipReducer::View(const AnimationClip& i_clip)
+{
+	const KeyedClipPoses& keys = i_clip.keys;
+
+	ClipView view;
+	view.frame_count = keys.frame_count;
+	view.joint_count = keys.joint_count;
+	view.is_looping = i_clip.is_looping;
+	view.parent_index = i_clip.poses.parent_index.data();
+	view.format = ClipFormat::Keyed;
+	view.track_bits = nullptr;
+	for (int channel = 0; channel < 3; channel++)
+	{
+		view.animated_count[channel] = 0;
+		view.constant_count[channel] = 0;
+	}
+	view.rotations = keys.rotations.data();
+	view.translations = keys.translations.data();
+	view.scales = keys.scales.data();
+	view.ranges = nullptr;
+	view.packed_rotations = nullptr;
+	view.packed_translations = nullptr;
+	view.packed_scales = nullptr;
+	view.bit_rates = nullptr;
+	view.packed_frames = nullptr;
+	view.frame_words = 0;
+	view.keyed_joints = keys.joints.data();
+	view.rotation_frames = keys.rotation_frames.data();
+	view.translation_frames = keys.translation_frames.data();
+	view.scale_frames = keys.scale_frames.data();
+	return view;
+}
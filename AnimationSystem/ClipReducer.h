@@ -0,0 +1,29 @@
+#pragma once
+#include "ClipCompressor.h"
+
+// Error bound of ClipReducer
+struct ClipReductionSettings
+{
+	// Largest distance a virtual vertex may move, in model units
+	float tolerance = 0.01f;
+	// Virtual vertices sit on the three axes of a joint, this far out plus the reach of its children
+	float shell_distance = 3.0f;
+};
+
+// Drops the keys of a clip that interpolation between the remaining keys reproduces closely enough.
+// The error is measured in model space at virtual vertices around every joint, with the already reduced parents,
+// so a rotation key of a long bone is worth more than one of a short bone and errors down a chain add up.
+class ClipReducer
+{
+public:
+	// Reduce io_clip.poses into io_clip.keys and print how many keys were kept.
+	// Constant tracks keep one key and, with the skeleton the clip is remapped to, tracks holding the bind pose none.
+	static bool Reduce(AnimationClip& io_clip, const Skeleton* i_skeleton = nullptr, const ClipReductionSettings& i_settings = ClipReductionSettings());
+
+	// Copy the keys of a clip read with AnimationImportMode::CurveKeys into io_clip.keys, every track keeps the times of its fbx curve keys.
+	// The clip has to be remapped to the skeleton first so its tracks are in joint order.
+	static bool KeysFromTracks(AnimationClip& io_clip);
+
+	// Sample the keys of a reduced clip or of curve keys
+	static ClipView View(const AnimationClip& i_clip);
+};
@@ -0,0 +1,464 @@
+#include "ClipSampler.h"
+#include "ClipCompressor.h"
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static_assert(sizeof(glm::quat) == 4 * sizeof(float), "quaternions are blended as four packed floats");
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "translations are blended as packed floats");
+
+namespace
+{
+	int LowestBit(uint32_t i_word)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, i_word);
+		return static_cast<int>(index);
+#else
+		return __builtin_ctz(i_word);
+#endif
+	}
+
+	// Visit the joints of a track set in order with their position among the stored tracks, every joint when there are no bits
+	template <class Visit>
+	void ForEachTrack(const uint32_t* i_bits, int i_jointcount, Visit i_visit)
+	{
+		if (!i_bits)
+		{
+			for (int j = 0; j < i_jointcount; j++)
+			{
+				i_visit(j, j);
+			}
+			return;
+		}
+
+		int stored = 0;
+		for (int word = 0; word < ClipTracks::Words(i_jointcount); word++)
+		{
+			for (uint32_t bits = i_bits[word]; bits; bits &= bits - 1)
+			{
+				i_visit(word * 32 + LowestBit(bits), stored++);
+			}
+		}
+	}
+
+	const uint32_t* AnimatedTracks(const ClipView& i_clip, int i_channel)
+	{
+		return i_clip.track_bits ? ClipTracks::Animated(i_clip.track_bits, i_clip.joint_count, i_channel) : nullptr;
+	}
+
+	// Nothing is constant without bits
+	template <class Visit>
+	void ForEachConstantTrack(const ClipView& i_clip, int i_channel, Visit i_visit)
+	{
+		if (i_clip.track_bits)
+		{
+			ForEachTrack(ClipTracks::Constant(i_clip.track_bits, i_clip.joint_count, i_channel), i_clip.joint_count, i_visit);
+		}
+	}
+
+	// Up to 62 bits from i_bit on. The word after the last one of a frame is always readable, clips end with a padding word.
+	uint64_t ReadBits(const uint32_t* i_words, size_t i_bit, int i_count)
+	{
+		const uint32_t* word = i_words + (i_bit >> 5);
+		const int shift = static_cast<int>(i_bit & 31);
+		uint64_t value = (word[0] | static_cast<uint64_t>(word[1]) << 32) >> shift;
+		if (shift + i_count > 64)
+		{
+			value |= static_cast<uint64_t>(word[2]) << (64 - shift);
+		}
+		return value & ((static_cast<uint64_t>(1) << i_count) - 1);
+	}
+}
+
+ClipView ClipSampler::View(const AnimationClip& i_clip)
+{
+	const ClipPoses& poses = i_clip.poses;
+
+	ClipView view;
+	view.frame_count = poses.frame_count;
+	view.joint_count = poses.joint_count;
+	view.is_looping = i_clip.is_looping;
+	view.parent_index = poses.parent_index.data();
+	view.rotations = poses.rotations.data();
+	view.translations = poses.translations.data();
+	view.scales = poses.scales.data();
+	view.format = ClipFormat::Float;
+	view.track_bits = nullptr;
+	for (int channel = 0; channel < 3; channel++)
+	{
+		view.animated_count[channel] = poses.joint_count;
+		view.constant_count[channel] = 0;
+	}
+	view.ranges = nullptr;
+	view.packed_rotations = nullptr;
+	view.packed_translations = nullptr;
+	view.packed_scales = nullptr;
+	view.bit_rates = nullptr;
+	view.packed_frames = nullptr;
+	view.frame_words = 0;
+	view.keyed_joints = nullptr;
+	view.rotation_frames = nullptr;
+	view.translation_frames = nullptr;
+	view.scale_frames = nullptr;
+	return view;
+}
+
+void ClipSampler::SampleFrame(const ClipView& i_clip, float i_frame, glm::quat* o_rotations, glm::vec3* o_translations, float* o_scales)
+{
+	if (i_clip.frame_count <= 0 || i_clip.joint_count <= 0)
+	{
+		return;
+	}
+
+	const float length = static_cast<float>(i_clip.frame_count);
+	float frame = i_frame;
+	if (i_clip.is_looping)
+	{
+		frame = std::fmod(frame, length);
+		if (frame < 0.0f)
+		{
+			frame += length;
+		}
+	}
+	else
+	{
+		frame = frame < 0.0f ? 0.0f : (frame > length - 1.0f ? length - 1.0f : frame);
+	}
+
+	if (i_clip.format == ClipFormat::Keyed)
+	{
+		SampleKeys(i_clip, frame, o_rotations, o_translations, o_scales);
+		return;
+	}
+
+	int a = static_cast<int>(frame);
+	if (a >= i_clip.frame_count)
+	{
+		a = i_clip.frame_count - 1;
+	}
+	int b = a + 1;
+	if (b >= i_clip.frame_count)
+	{
+		b = i_clip.is_looping ? 0 : a;
+	}
+	const float alpha = frame - static_cast<float>(a);
+
+	if (i_clip.format == ClipFormat::Float)
+	{
+		SampleFloatFrames(i_clip, a, b, alpha, o_rotations, o_translations, o_scales);
+	}
+	else if (i_clip.format == ClipFormat::Variable)
+	{
+		SampleVariableFrames(i_clip, a, b, alpha, o_rotations, o_translations, o_scales);
+	}
+	else
+	{
+		SampleQuantizedFrames(i_clip, a, b, alpha, o_rotations, o_translations, o_scales);
+	}
+}
+
+void ClipSampler::SampleFloatFrames(const ClipView& i_clip, int i_first, int i_second, float i_alpha, glm::quat* o_rotations, glm::vec3* o_translations, float* o_scales)
+{
+	if (!i_clip.track_bits)
+	{
+		const size_t joints = static_cast<size_t>(i_clip.joint_count);
+		const size_t first = i_first * joints;
+		const size_t second = i_second * joints;
+
+		BlendRotations(i_clip.rotations + first, i_clip.rotations + second, i_alpha, o_rotations, i_clip.joint_count);
+		BlendFloats(&i_clip.translations[first].x, &i_clip.translations[second].x, i_alpha, &o_translations[0].x, joints * 3);
+		BlendFloats(i_clip.scales + first, i_clip.scales + second, i_alpha, o_scales, joints);
+		return;
+	}
+
+	ForEachConstantTrack(i_clip, ClipTracks::Rotation, [&](int i_joint, int i_track) { o_rotations[i_joint] = i_clip.rotations[i_track]; });
+	ForEachConstantTrack(i_clip, ClipTracks::Translation, [&](int i_joint, int i_track) { o_translations[i_joint] = i_clip.translations[i_track]; });
+	ForEachConstantTrack(i_clip, ClipTracks::Scale, [&](int i_joint, int i_track) { o_scales[i_joint] = i_clip.scales[i_track]; });
+
+	// The animated tracks of a frame are stored side by side, so each channel is blended in one go into scratch and then handed out to its joints
+	thread_local std::vector<glm::quat> rotations;
+	thread_local std::vector<glm::vec3> translations;
+	thread_local std::vector<float> scales;
+	const int rotationCount = i_clip.animated_count[ClipTracks::Rotation];
+	const int translationCount = i_clip.animated_count[ClipTracks::Translation];
+	const int scaleCount = i_clip.animated_count[ClipTracks::Scale];
+	rotations.resize(rotationCount);
+	translations.resize(translationCount);
+	scales.resize(scaleCount);
+
+	const glm::quat* rotationsA = i_clip.rotations + i_clip.constant_count[ClipTracks::Rotation] + static_cast<size_t>(i_first) * rotationCount;
+	const glm::quat* rotationsB = i_clip.rotations + i_clip.constant_count[ClipTracks::Rotation] + static_cast<size_t>(i_second) * rotationCount;
+	BlendRotations(rotationsA, rotationsB, i_alpha, rotations.data(), rotationCount);
+	ForEachTrack(AnimatedTracks(i_clip, ClipTracks::Rotation), i_clip.joint_count, [&](int i_joint, int i_track) { o_rotations[i_joint] = rotations[i_track]; });
+
+	const glm::vec3* translationsA = i_clip.translations + i_clip.constant_count[ClipTracks::Translation] + static_cast<size_t>(i_first) * translationCount;
+	const glm::vec3* translationsB = i_clip.translations + i_clip.constant_count[ClipTracks::Translation] + static_cast<size_t>(i_second) * translationCount;
+	if (translationCount > 0)
+	{
+		BlendFloats(glm::value_ptr(translationsA[0]), glm::value_ptr(translationsB[0]), i_alpha, glm::value_ptr(translations[0]), static_cast<size_t>(translationCount) * 3);
+	}
+	ForEachTrack(AnimatedTracks(i_clip, ClipTracks::Translation), i_clip.joint_count, [&](int i_joint, int i_track) { o_translations[i_joint] = translations[i_track]; });
+
+	const float* scalesA = i_clip.scales + i_clip.constant_count[ClipTracks::Scale] + static_cast<size_t>(i_first) * scaleCount;
+	const float* scalesB = i_clip.scales + i_clip.constant_count[ClipTracks::Scale] + static_cast<size_t>(i_second) * scaleCount;
+	BlendFloats(scalesA, scalesB, i_alpha, scales.data(), scaleCount);
+	ForEachTrack(AnimatedTracks(i_clip, ClipTracks::Scale), i_clip.joint_count, [&](int i_joint, int i_track) { o_scales[i_joint] = scales[i_track]; });
+}
+
+namespace
+{
+	// Key before or at i_frame and the blend towards the key after it. Past the last key a looping clip blends into its first key,
+	// which is one frame later since the last frame is always a key.
+	void FindKeys(const float* i_frames, uint32_t i_count, float i_frame, bool i_looping, uint32_t& o_first, uint32_t& o_second, float& o_alpha)
+	{
+		const float* found = std::upper_bound(i_frames, i_frames + i_count, i_frame);
+		o_first = found == i_frames ? 0 : static_cast<uint32_t>(found - i_frames - 1);
+		o_second = o_first + 1;
+		if (o_second < i_count)
+		{
+			o_alpha = (i_frame - i_frames[o_first]) / (i_frames[o_second] - i_frames[o_first]);
+		}
+		else
+		{
+			o_second = i_looping ? 0 : o_first;
+			o_alpha = i_looping ? i_frame - i_frames[o_first] : 0.0f;
+		}
+		o_alpha = std::min(std::max(o_alpha, 0.0f), 1.0f);
+	}
+}
+
+void ClipSampler::SampleKeys(const ClipView& i_clip, float i_frame, glm::quat* o_rotations, glm::vec3* o_translations, float* o_scales)
+{
+	uint32_t first, second;
+	float alpha;
+	for (int j = 0; j < i_clip.joint_count; j++)
+	{
+		const KeyedJoint& keys = i_clip.keyed_joints[j];
+
+		if (keys.rotation_count == 1)
+		{
+			o_rotations[j] = i_clip.rotations[keys.rotation_first];
+		}
+		else if (keys.rotation_count > 1)
+		{
+			FindKeys(i_clip.rotation_frames + keys.rotation_first, keys.rotation_count, i_frame, i_clip.is_looping, first, second, alpha);
+			BlendRotations(i_clip.rotations + keys.rotation_first + first, i_clip.rotations + keys.rotation_first + second, alpha, o_rotations + j, 1);
+		}
+
+		if (keys.translation_count == 1)
+		{
+			o_translations[j] = i_clip.translations[keys.translation_first];
+		}
+		else if (keys.translation_count > 1)
+		{
+			FindKeys(i_clip.translation_frames + keys.translation_first, keys.translation_count, i_frame, i_clip.is_looping, first, second, alpha);
+			const glm::vec3& translationA = i_clip.translations[keys.translation_first + first];
+			const glm::vec3& translationB = i_clip.translations[keys.translation_first + second];
+			o_translations[j] = translationA + (translationB - translationA) * alpha;
+		}
+
+		if (keys.scale_count == 1)
+		{
+			o_scales[j] = i_clip.scales[keys.scale_first];
+		}
+		else if (keys.scale_count > 1)
+		{
+			FindKeys(i_clip.scale_frames + keys.scale_first, keys.scale_count, i_frame, i_clip.is_looping, first, second, alpha);
+			const float scaleA = i_clip.scales[keys.scale_first + first];
+			const float scaleB = i_clip.scales[keys.scale_first + second];
+			o_scales[j] = scaleA + (scaleB - scaleA) * alpha;
+		}
+	}
+}
+
+void ClipSampler::SampleQuantizedFrames(const ClipView& i_clip, int i_first, int i_second, float i_alpha, glm::quat* o_rotations, glm::vec3* o_translations, float* o_scales)
+{
+	const size_t words = ClipCompressor::RotationWords(i_clip.format);
+	const float unorm = 1.0f / 65535.0f;
+
+	// Stored track numbers of the two frames in every channel
+	size_t first[3], second[3];
+	for (int channel = 0; channel < 3; channel++)
+	{
+		first[channel] = i_clip.constant_count[channel] + static_cast<size_t>(i_first) * i_clip.animated_count[channel];
+		second[channel] = i_clip.constant_count[channel] + static_cast<size_t>(i_second) * i_clip.animated_count[channel];
+	}
+
+	ForEachConstantTrack(i_clip, ClipTracks::Rotation, [&](int i_joint, int i_track)
+	{
+		o_rotations[i_joint] = ClipCompressor::DecodeRotation(i_clip.packed_rotations + i_track * words, i_clip.format);
+	});
+	ForEachTrack(AnimatedTracks(i_clip, ClipTracks::Rotation), i_clip.joint_count, [&](int i_joint, int i_track)
+	{
+		glm::quat rotationA = ClipCompressor::DecodeRotation(i_clip.packed_rotations + (first[ClipTracks::Rotation] + i_track) * words, i_clip.format);
+		glm::quat rotationB = ClipCompressor::DecodeRotation(i_clip.packed_rotations + (second[ClipTracks::Rotation] + i_track) * words, i_clip.format);
+		if (glm::dot(rotationA, rotationB) < 0.0f)
+		{
+			rotationB = -rotationB;
+		}
+		o_rotations[i_joint] = glm::normalize(rotationA * (1.0f - i_alpha) + rotationB * i_alpha);
+	});
+
+	// The range is affine, so the quantized values are blended and decoded once
+	auto translation = [&](int i_joint, size_t i_a, size_t i_b)
+	{
+		const TrackRange& range = i_clip.ranges[i_joint];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float translationA = i_clip.packed_translations[i_a * 3 + axis];
+			float translationB = i_clip.packed_translations[i_b * 3 + axis];
+			o_translations[i_joint][axis] = range.translation_min[axis] + range.translation_extent[axis] * (translationA + (translationB - translationA) * i_alpha) * unorm;
+		}
+	};
+	ForEachConstantTrack(i_clip, ClipTracks::Translation, [&](int i_joint, int i_track) { translation(i_joint, i_track, i_track); });
+	ForEachTrack(AnimatedTracks(i_clip, ClipTracks::Translation), i_clip.joint_count, [&](int i_joint, int i_track)
+	{
+		translation(i_joint, first[ClipTracks::Translation] + i_track, second[ClipTracks::Translation] + i_track);
+	});
+
+	auto scale = [&](int i_joint, size_t i_a, size_t i_b)
+	{
+		const TrackRange& range = i_clip.ranges[i_joint];
+		float scaleA = i_clip.packed_scales[i_a];
+		float scaleB = i_clip.packed_scales[i_b];
+		o_scales[i_joint] = range.scale_min + range.scale_extent * (scaleA + (scaleB - scaleA) * i_alpha) * unorm;
+	};
+	ForEachConstantTrack(i_clip, ClipTracks::Scale, [&](int i_joint, int i_track) { scale(i_joint, i_track, i_track); });
+	ForEachTrack(AnimatedTracks(i_clip, ClipTracks::Scale), i_clip.joint_count, [&](int i_joint, int i_track)
+	{
+		scale(i_joint, first[ClipTracks::Scale] + i_track, second[ClipTracks::Scale] + i_track);
+	});
+}
+
+void ClipSampler::SampleVariableFrames(const ClipView& i_clip, int i_first, int i_second, float i_alpha, glm::quat* o_rotations, glm::vec3* o_translations, float* o_scales)
+{
+	ForEachConstantTrack(i_clip, ClipTracks::Rotation, [&](int i_joint, int i_track) { o_rotations[i_joint] = i_clip.rotations[i_track]; });
+	ForEachConstantTrack(i_clip, ClipTracks::Translation, [&](int i_joint, int i_track) { o_translations[i_joint] = i_clip.translations[i_track]; });
+	ForEachConstantTrack(i_clip, ClipTracks::Scale, [&](int i_joint, int i_track) { o_scales[i_joint] = i_clip.scales[i_track]; });
+
+	// Both frames have the same layout, one bit position walks through them together
+	const uint32_t* frameA = i_clip.packed_frames + static_cast<size_t>(i_first) * i_clip.frame_words;
+	const uint32_t* frameB = i_clip.packed_frames + static_cast<size_t>(i_second) * i_clip.frame_words;
+	const uint8_t* rate = i_clip.bit_rates;
+	size_t bit = 0;
+
+	ForEachTrack(AnimatedTracks(i_clip, ClipTracks::Rotation), i_clip.joint_count, [&](int i_joint, int)
+	{
+		const int bits = *rate++;
+		const int count = 2 + 3 * bits;
+		const glm::quat rotationA = ClipCompressor::UnpackRotation(ReadBits(frameA, bit, count), bits);
+		const glm::quat rotationB = ClipCompressor::UnpackRotation(ReadBits(frameB, bit, count), bits);
+		bit += count;
+		BlendRotations(&rotationA, &rotationB, i_alpha, o_rotations + i_joint, 1);
+	});
+
+	// The range is affine, so the quantized values are blended and decoded once
+	ForEachTrack(AnimatedTracks(i_clip, ClipTracks::Translation), i_clip.joint_count, [&](int i_joint, int)
+	{
+		const int bits = *rate++;
+		const float unorm = ClipCompressor::UnpackUnorm(1, bits);
+		const TrackRange& range = i_clip.ranges[i_joint];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float translationA = static_cast<float>(ReadBits(frameA, bit, bits));
+			const float translationB = static_cast<float>(ReadBits(frameB, bit, bits));
+			bit += bits;
+			o_translations[i_joint][axis] = range.translation_min[axis] + range.translation_extent[axis] * (translationA + (translationB - translationA) * i_alpha) * unorm;
+		}
+	});
+
+	ForEachTrack(AnimatedTracks(i_clip, ClipTracks::Scale), i_clip.joint_count, [&](int i_joint, int)
+	{
+		const int bits = *rate++;
+		const TrackRange& range = i_clip.ranges[i_joint];
+		const float scaleA = static_cast<float>(ReadBits(frameA, bit, bits));
+		const float scaleB = static_cast<float>(ReadBits(frameB, bit, bits));
+		bit += bits;
+		o_scales[i_joint] = range.scale_min + range.scale_extent * (scaleA + (scaleB - scaleA) * i_alpha) * ClipCompressor::UnpackUnorm(1, bits);
+	});
+}
+
+glm::mat4 ClipSampler::ComposePose(const glm::quat& i_rotation, const glm::vec3& i_translation, float i_scale)
+{
+	glm::mat4 local(glm::mat3_cast(i_rotation) * i_scale);
+	local[3] = glm::vec4(i_translation, 1.0f);
+	return local;
+}
+
+void ClipSampler::DecomposePose(const glm::mat4& i_local, glm::quat& o_rotation, glm::vec3& o_translation, float& o_scale)
+{
+	glm::vec3 scale(glm::length(glm::vec3(i_local[0])), glm::length(glm::vec3(i_local[1])), glm::length(glm::vec3(i_local[2])));
+	glm::mat3 rotation(glm::vec3(i_local[0]) / scale.x, glm::vec3(i_local[1]) / scale.y, glm::vec3(i_local[2]) / scale.z);
+	o_translation = glm::vec3(i_local[3]);
+	o_rotation = glm::normalize(glm::quat_cast(rotation));
+	o_scale = scale.x;
+}
+
+void ClipSampler::LocalToModel(const int* i_parents, int i_jointcount, const glm::quat* i_rotations, const glm::vec3* i_translations, const float* i_scales, glm::mat4* o_matrices)
+{
+	for (int i = 0; i < i_jointcount; i++)
+	{
+		const glm::mat4 local = ComposePose(i_rotations[i], i_translations[i], i_scales[i]);
+		o_matrices[i] = i_parents[i] >= 0 ? o_matrices[i_parents[i]] * local : local;
+	}
+}
+
+void ClipSampler::BlendRotations(const glm::quat* i_a, const glm::quat* i_b, float i_alpha, glm::quat* o_result, int i_count)
+{
+	int i = 0;
+#if defined(_M_X64) || defined(__SSE2__)
+	const __m128 weightA = _mm_set1_ps(1.0f - i_alpha);
+	const __m128 weightB = _mm_set1_ps(i_alpha);
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	for (; i < i_count; i++)
+	{
+		__m128 a = _mm_loadu_ps(reinterpret_cast<const float*>(i_a + i));
+		__m128 b = _mm_loadu_ps(reinterpret_cast<const float*>(i_b + i));
+
+		// Dot product in every lane, b is flipped when it points away from a
+		__m128 dot = _mm_mul_ps(a, b);
+		dot = _mm_add_ps(dot, _mm_shuffle_ps(dot, dot, _MM_SHUFFLE(2, 3, 0, 1)));
+		dot = _mm_add_ps(dot, _mm_shuffle_ps(dot, dot, _MM_SHUFFLE(1, 0, 3, 2)));
+		b = _mm_xor_ps(b, _mm_and_ps(dot, signMask));
+
+		__m128 q = _mm_add_ps(_mm_mul_ps(a, weightA), _mm_mul_ps(b, weightB));
+		__m128 length = _mm_mul_ps(q, q);
+		length = _mm_add_ps(length, _mm_shuffle_ps(length, length, _MM_SHUFFLE(2, 3, 0, 1)));
+		length = _mm_add_ps(length, _mm_shuffle_ps(length, length, _MM_SHUFFLE(1, 0, 3, 2)));
+		_mm_storeu_ps(reinterpret_cast<float*>(o_result + i), _mm_div_ps(q, _mm_sqrt_ps(length)));
+	}
+#endif
+	for (; i < i_count; i++)
+	{
+		const glm::quat b = glm::dot(i_a[i], i_b[i]) < 0.0f ? -i_b[i] : i_b[i];
+		o_result[i] = glm::normalize(i_a[i] * (1.0f - i_alpha) + b * i_alpha);
+	}
+}
+
+void ClipSampler::BlendFloats(const float* i_a, const float* i_b, float i_alpha, float* o_result, size_t i_count)
+{
+	size_t i = 0;
+#if defined(_M_X64) || defined(__SSE2__)
+	const __m128 alpha = _mm_set1_ps(i_alpha);
+	for (; i + 4 <= i_count; i += 4)
+	{
+		__m128 a = _mm_loadu_ps(i_a + i);
+		__m128 b = _mm_loadu_ps(i_b + i);
+		_mm_storeu_ps(o_result + i, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), alpha)));
+	}
+#endif
+	for (; i < i_count; i++)
+	{
+		o_result[i] = i_a[i] + (i_b[i] - i_a[i]) * i_alpha;
+	}
+}
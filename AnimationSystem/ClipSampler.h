@@ -0,0 +1,127 @@
+#pragma once
+#include "SceneProxy.h"
+#include <cstdint>
+
+// Float keeps the poses as they were imported, the quantized formats store rotations as the three smallest
+// quaternion components in 48 or 32 bits and translations and scales as 16 bits within a range per joint
+enum class ClipFormat : uint32_t
+{
+	Float       = 0,
+	Quantized48 = 1,
+	Quantized32 = 2,
+	Keyed       = 3, // the keys ClipReducer kept, in floats
+	Variable    = 4, // every animated track in the bits ClipBitRate chose for it
+};
+
+// Range of the quantized translations and scales of one joint, a value is min + extent * quantized / 65535
+struct TrackRange
+{
+	glm::vec3 translation_min;
+	float     scale_min;
+	glm::vec3 translation_extent;
+	float     scale_extent;
+};
+
+// Bit sets of the tracks a dense clip stores, one bit per joint: the animated rotation, translation and scale tracks,
+// then the constant ones, Words each. Animated tracks are stored every frame, constant ones once,
+// a track in neither set holds the bind pose and is left alone by the sampler.
+struct ClipTracks
+{
+	enum Channel
+	{
+		Rotation    = 0,
+		Translation = 1,
+		Scale       = 2,
+	};
+
+	static int Words(int i_jointcount)
+	{
+		return (i_jointcount + 31) / 32;
+	}
+	static const uint32_t* Animated(const uint32_t* i_bits, int i_jointcount, int i_channel)
+	{
+		return i_bits + i_channel * Words(i_jointcount);
+	}
+	static const uint32_t* Constant(const uint32_t* i_bits, int i_jointcount, int i_channel)
+	{
+		return i_bits + (3 + i_channel) * Words(i_jointcount);
+	}
+};
+
+// Read only view of the channels of one clip.
+// Points into a cooked file or into the poses of an imported clip.
+struct ClipView
+{
+	int              frame_count;
+	int              joint_count;
+	bool             is_looping;
+	const int*       parent_index;
+	ClipFormat       format;
+
+	// Dense formats: every channel starts with its constant tracks, followed by the animated tracks of every frame.
+	// Without track_bits every track is animated and a frame is laid out [joint] like ClipPoses.
+	const uint32_t*  track_bits;
+	int              animated_count[3];
+	int              constant_count[3];
+
+	// ClipFormat::Float
+	const glm::quat* rotations;
+	const glm::vec3* translations;
+	const float*     scales;
+
+	// Quantized formats
+	const TrackRange* ranges;              // one per joint
+	const uint16_t*   packed_rotations;    // ClipCompressor::RotationWords a pose
+	const uint16_t*   packed_translations; // three a pose
+	const uint16_t*   packed_scales;       // one a pose
+
+	// ClipFormat::Variable keeps its constant tracks in the float channels and its ranges above.
+	// A frame is frame_words words of the animated rotation, translation and scale tracks in joint order,
+	// with the bits of a component in bit_rates, one a track in the same order. Rotations take 2 + 3 * bits.
+	const uint8_t*    bit_rates;
+	const uint32_t*   packed_frames;
+	uint32_t          frame_words;
+
+	// ClipFormat::Keyed, the first key of every joint indexes the frames below and rotations, translations and scales above.
+	// A constant track has one key and a track that holds the bind pose none.
+	const KeyedJoint* keyed_joints;
+	const float*      rotation_frames;
+	const float*      translation_frames;
+	const float*      scale_frames;
+};
+
+class ClipSampler
+{
+public:
+	static ClipView View(const AnimationClip& i_clip);
+
+	// Local poses at a fractional frame, blended between floor(i_frame) and the frame after it.
+	// A looping clip blends its last frame into the first one, otherwise the last frame is held.
+	// Joints whose track holds the bind pose are not written, the outputs should start out as the bind pose.
+	// A frame without stripped tracks is one contiguous run per channel, which is blended four floats per instruction where SSE2 is available.
+	// Quantized and variable bit rate clips are decoded track by track while they are blended.
+	static void SampleFrame(const ClipView& i_clip, float i_frame, glm::quat* o_rotations, glm::vec3* o_translations, float* o_scales);
+
+	// Same at a time in seconds
+	static void Sample(const ClipView& i_clip, float i_time, float i_framepersecond, glm::quat* o_rotations, glm::vec3* o_translations, float* o_scales)
+	{
+		SampleFrame(i_clip, i_time * i_framepersecond, o_rotations, o_translations, o_scales);
+	}
+
+	static glm::mat4 ComposePose(const glm::quat& i_rotation, const glm::vec3& i_translation, float i_scale);
+	// Split an affine transform into a rotation, translation and uniform scale
+	static void DecomposePose(const glm::mat4& i_local, glm::quat& o_rotation, glm::vec3& o_translation, float& o_scale);
+
+	// Compose local poses into model space matrices, parents come first so one pass is enough
+	static void LocalToModel(const int* i_parents, int i_jointcount, const glm::quat* i_rotations, const glm::vec3* i_translations, const float* i_scales, glm::mat4* o_matrices);
+
+private:
+	static void SampleKeys(const ClipView& i_clip, float i_frame, glm::quat* o_rotations, glm::vec3* o_translations, float* o_scales);
+	static void SampleFloatFrames(const ClipView& i_clip, int i_first, int i_second, float i_alpha, glm::quat* o_rotations, glm::vec3* o_translations, float* o_scales);
+	static void SampleQuantizedFrames(const ClipView& i_clip, int i_first, int i_second, float i_alpha, glm::quat* o_rotations, glm::vec3* o_translations, float* o_scales);
+	static void SampleVariableFrames(const ClipView& i_clip, int i_first, int i_second, float i_alpha, glm::quat* o_rotations, glm::vec3* o_translations, float* o_scales);
+
+	// Normalized lerp of every quaternion, taking the shorter way around
+	static void BlendRotations(const glm::quat* i_a, const glm::quat* i_b, float i_alpha, glm::quat* o_result, int i_count);
+	static void BlendFloats(const float* i_a, const float* i_b, float i_alpha, float* o_result, size_t i_count);
+};
@@ -10,6 +10,9 @@ namespace ConstantData
 		glm::mat4 model_position_matrix;
 		glm::mat4 model_view_perspective_matrix;
 		glm::mat4 model_inverse_transpose_matrix;
+		// Decodes packed positions as offset + position * scale, zero and one for the full vertex format
+		glm::vec4 position_offset;
+		glm::vec4 position_scale;
 	};
 
 	struct Skeleton
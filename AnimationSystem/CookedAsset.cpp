@@ -0,0 +1,835 @@
+#include "CookedAsset.h"
+#include "ClipBitRate.h"
+#include "ThreadPool.h"
+#include "VertexPacker.h"
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	uint64_t AlignUp(uint64_t i_value)
+	{
+		return (i_value + CookedData::Alignment - 1) & ~static_cast<uint64_t>(CookedData::Alignment - 1);
+	}
+
+	void WritePadding(std::ofstream& io_file, uint64_t i_from, uint64_t i_to)
+	{
+		static const char zeros[CookedData::Alignment] = {};
+		io_file.write(zeros, static_cast<std::streamsize>(i_to - i_from));
+	}
+
+	void CopyName(char* o_name, size_t i_size, const char* i_source)
+	{
+		// memcpy instead of strncpy, which is deprecated under SDL checks
+		size_t length = strlen(i_source);
+		length = length < i_size - 1 ? length : i_size - 1;
+		memcpy(o_name, i_source, length);
+		o_name[length] = '\0';
+	}
+
+	bool HasBit(const uint32_t* i_bits, int i_joint)
+	{
+		return ((i_bits[i_joint / 32] >> (i_joint % 32)) & 1) != 0;
+	}
+
+	int CountBits(const uint32_t* i_bits, int i_words)
+	{
+		int count = 0;
+		for (int word = 0; word < i_words; word++)
+		{
+			for (uint32_t bits = i_bits[word]; bits; bits &= bits - 1)
+			{
+				count++;
+			}
+		}
+		return count;
+	}
+
+	// Constant tracks of a channel at frame 0, then the animated tracks of every frame, in the order ClipSampler reads them
+	template <class Append>
+	void AppendTracks(const ClipTrackLayout& i_layout, int i_channel, int i_framecount, int i_jointcount, Append i_append)
+	{
+		const uint32_t* constant = ClipTracks::Constant(i_layout.bits.data(), i_jointcount, i_channel);
+		const uint32_t* animated = ClipTracks::Animated(i_layout.bits.data(), i_jointcount, i_channel);
+		for (int j = 0; j < i_jointcount; j++)
+		{
+			if (HasBit(constant, j))
+			{
+				i_append(static_cast<size_t>(j));
+			}
+		}
+		for (int f = 0; f < i_framecount; f++)
+		{
+			for (int j = 0; j < i_jointcount; j++)
+			{
+				if (HasBit(animated, j))
+				{
+					i_append(static_cast<size_t>(f) * i_jointcount + j);
+				}
+			}
+		}
+	}
+}
+
+CookedAsset::~CookedAsset()
+{
+	CleanUp();
+}
+
+bool CookedAsset::Cook(const char* i_filepath, const Skeleton& i_skeleton, const std::vector<MeshData>& i_mesh, const std::vector<int>& i_index,
+	const std::vector<SubMesh>& i_submeshes, const std::vector<MeshLod>& i_lods, const std::vector<MaterialData>& i_materials, const AnimationClip& i_clip, CookedData::VertexFormat i_format, ClipFormat i_clipformat)
+{
+	return Cook(i_filepath, i_skeleton, i_mesh, i_index, i_submeshes, i_lods, i_materials, &i_clip, 1, i_format, i_clipformat);
+}
+
+bool CookedAsset::Cook(const char* i_filepath, const Skeleton& i_skeleton, const std::vector<MeshData>& i_mesh, const std::vector<int>& i_index,
+	const std::vector<SubMesh>& i_submeshes, const std::vector<MeshLod>& i_lods, const std::vector<MaterialData>& i_materials, const AnimationClip* i_clips, size_t i_clipcount, CookedData::VertexFormat i_format, ClipFormat i_clipformat)
+{
+	// Convert joints to fixed size records
+	std::vector<CookedData::Joint> joints(i_skeleton.joints.size());
+	for (size_t i = 0; i < i_skeleton.joints.size(); i++)
+	{
+		// The runtime walks the joints once from the root, a parent has to come before its children
+		if (i_skeleton.joints[i].parent_index >= static_cast<int>(i))
+		{
+			printf("Cannot cook %s, joint %s comes before its parent\n", i_filepath, i_skeleton.joints[i].name.c_str());
+			return false;
+		}
+
+		memset(&joints[i], 0, sizeof(joints[i]));
+		joints[i].inversed = i_skeleton.joints[i].inversed;
+		joints[i].coord = i_skeleton.joints[i].coord;
+		joints[i].parent_index = i_skeleton.joints[i].parent_index;
+		CopyName(joints[i].name, sizeof(joints[i].name), i_skeleton.joints[i].name.c_str());
+	}
+
+	// Every clip is checked before any of them is compressed
+	for (size_t c = 0; c < i_clipcount; c++)
+	{
+		const ClipPoses& i_poses = i_clips[c].poses;
+		const size_t count = static_cast<size_t>(i_poses.frame_count) * i_poses.joint_count;
+		if (i_poses.frame_count < 0 || i_poses.joint_count < 0 || i_poses.rotations.size() != count || i_poses.translations.size() != count
+			|| i_poses.scales.size() != count || i_poses.parent_index.size() != static_cast<size_t>(i_poses.joint_count))
+		{
+			printf("Cannot cook %s, the pose channels of %s do not match its frame and joint count\n", i_filepath, i_clips[c].name.c_str());
+			return false;
+		}
+		for (int j = 0; j < i_poses.joint_count; j++)
+		{
+			if (i_poses.parent_index[j] >= j)
+			{
+				printf("Cannot cook %s, a pose of %s comes before its parent\n", i_filepath, i_clips[c].name.c_str());
+				return false;
+			}
+		}
+		// Curve keys have no frames to build the dense formats from
+		if (!i_clips[c].tracks.empty() && i_clipformat != ClipFormat::Keyed)
+		{
+			printf("Cannot cook %s, %s was read as curve keys and is only cooked keyed\n", i_filepath, i_clips[c].name.c_str());
+			return false;
+		}
+	}
+
+	// Variable bit rate clips are searched side by side, every search also spreads its joints over the pool
+	std::vector<VariableClipPoses> variable(i_clipformat == ClipFormat::Variable ? i_clipcount : 0);
+	std::vector<ClipBitRateReport> reports(variable.size());
+	std::vector<char> compressed(variable.size(), 0);
+	ThreadPool::Get().ParallelFor(0, static_cast<int>(variable.size()), [&](int begin, int end)
+	{
+		for (int c = begin; c < end; c++)
+		{
+			compressed[c] = ClipBitRate::Compress(i_clips[c], &i_skeleton, variable[c], reports[c]) ? 1 : 0;
+		}
+	});
+	for (size_t c = 0; c < variable.size(); c++)
+	{
+		if (!compressed[c])
+		{
+			printf("Cannot cook %s, %s could not be compressed\n", i_filepath, i_clips[c].name.c_str());
+			return false;
+		}
+		ClipBitRate::Print(i_clips[c], reports[c]);
+	}
+
+	// Append the channels of every clip one after another, quantized clips only write the quantized channels
+	// and keyed clips write their keys to the float channels. Dense clips leave out their bind pose tracks
+	// and store their constant tracks once, variable bit rate clips write their constant tracks to the float channels.
+	std::vector<CookedData::Clip> clips(i_clipcount);
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> translations;
+	std::vector<float> scales;
+	std::vector<int> parents;
+	std::vector<TrackRange> ranges;
+	std::vector<uint16_t> quantizedrotations;
+	std::vector<uint16_t> quantizedtranslations;
+	std::vector<uint16_t> quantizedscales;
+	std::vector<KeyedJoint> keyedjoints;
+	std::vector<float> rotationframes;
+	std::vector<float> translationframes;
+	std::vector<float> scaleframes;
+	std::vector<uint32_t> trackbits;
+	std::vector<uint8_t> bitrates;
+	std::vector<uint32_t> variableframes;
+	const bool quantize = i_clipformat == ClipFormat::Quantized48 || i_clipformat == ClipFormat::Quantized32;
+	for (size_t c = 0; c < i_clipcount; c++)
+	{
+		const ClipPoses& i_poses = i_clips[c].poses;
+		CookedData::Clip& clip = clips[c];
+		memset(&clip, 0, sizeof(clip));
+		clip.first_parent = parents.size();
+		clip.format = i_clipformat;
+		clip.frame_count = i_poses.frame_count;
+		clip.joint_count = i_poses.joint_count;
+		clip.frame_per_second = i_clips[c].frame_per_second;
+		clip.is_looping = i_clips[c].is_looping ? 1 : 0;
+		CopyName(clip.name, sizeof(clip.name), i_clips[c].name.c_str());
+
+		if (i_clipformat == ClipFormat::Keyed)
+		{
+			// Curve keys span the frames of the clip without poses for them
+			const KeyedClipPoses& keys = i_clips[c].keys;
+			const int frames = i_clips[c].tracks.empty() ? clip.frame_count : i_clips[c].frame_count;
+			if (keys.frame_count != frames || keys.joint_count != clip.joint_count || keys.joints.size() != static_cast<size_t>(clip.joint_count))
+			{
+				printf("Cannot cook %s, %s has not been reduced\n", i_filepath, i_clips[c].name.c_str());
+				return false;
+			}
+			clip.frame_count = frames;
+
+			// Key indices are made relative to the whole section
+			for (KeyedJoint joint : keys.joints)
+			{
+				joint.rotation_first += static_cast<uint32_t>(rotations.size());
+				joint.translation_first += static_cast<uint32_t>(translations.size());
+				joint.scale_first += static_cast<uint32_t>(scales.size());
+				keyedjoints.push_back(joint);
+			}
+			rotationframes.insert(rotationframes.end(), keys.rotation_frames.begin(), keys.rotation_frames.end());
+			rotations.insert(rotations.end(), keys.rotations.begin(), keys.rotations.end());
+			translationframes.insert(translationframes.end(), keys.translation_frames.begin(), keys.translation_frames.end());
+			translations.insert(translations.end(), keys.translations.begin(), keys.translations.end());
+			scaleframes.insert(scaleframes.end(), keys.scale_frames.begin(), keys.scale_frames.end());
+			scales.insert(scales.end(), keys.scales.begin(), keys.scales.end());
+		}
+		else
+		{
+			ClipTrackLayout layout;
+			if (variable.empty())
+			{
+				ClipCompressor::PrintTracks(i_clips[c], ClipCompressor::ClassifyTracks(i_clips[c], &i_skeleton, layout));
+			}
+			else
+			{
+				layout = variable[c].layout;
+			}
+			clip.first_bits = trackbits.size();
+			trackbits.insert(trackbits.end(), layout.bits.begin(), layout.bits.end());
+			for (int channel = 0; channel < 3; channel++)
+			{
+				clip.animated_count[channel] = layout.animated_count[channel];
+				clip.constant_count[channel] = layout.constant_count[channel];
+			}
+
+			const int frames = clip.frame_count;
+			const int joints = clip.joint_count;
+			if (!variable.empty())
+			{
+				const VariableClipPoses& poses = variable[c];
+				ranges.insert(ranges.end(), poses.ranges.begin(), poses.ranges.end());
+				clip.first_value[ClipTracks::Rotation] = rotations.size();
+				clip.first_value[ClipTracks::Translation] = translations.size();
+				clip.first_value[ClipTracks::Scale] = scales.size();
+				rotations.insert(rotations.end(), poses.constant_rotations.begin(), poses.constant_rotations.end());
+				translations.insert(translations.end(), poses.constant_translations.begin(), poses.constant_translations.end());
+				scales.insert(scales.end(), poses.constant_scales.begin(), poses.constant_scales.end());
+				clip.first_rate = bitrates.size();
+				bitrates.insert(bitrates.end(), poses.bit_rates.begin(), poses.bit_rates.end());
+				clip.first_frame = variableframes.size();
+				clip.frame_words = poses.frame_words;
+				variableframes.insert(variableframes.end(), poses.frames.begin(), poses.frames.end());
+			}
+			else if (quantize)
+			{
+				QuantizedClipPoses quantized;
+				ClipCompressor::Quantize(i_clips[c], i_clipformat, quantized);
+				ranges.insert(ranges.end(), quantized.ranges.begin(), quantized.ranges.end());
+
+				const size_t words = ClipCompressor::RotationWords(i_clipformat);
+				clip.first_value[ClipTracks::Rotation] = quantizedrotations.size() / words;
+				clip.first_value[ClipTracks::Translation] = quantizedtranslations.size() / 3;
+				clip.first_value[ClipTracks::Scale] = quantizedscales.size();
+				AppendTracks(layout, ClipTracks::Rotation, frames, joints, [&](size_t i_value)
+				{
+					quantizedrotations.insert(quantizedrotations.end(), quantized.rotations.begin() + i_value * words, quantized.rotations.begin() + (i_value + 1) * words);
+				});
+				AppendTracks(layout, ClipTracks::Translation, frames, joints, [&](size_t i_value)
+				{
+					quantizedtranslations.insert(quantizedtranslations.end(), quantized.translations.begin() + i_value * 3, quantized.translations.begin() + (i_value + 1) * 3);
+				});
+				AppendTracks(layout, ClipTracks::Scale, frames, joints, [&](size_t i_value) { quantizedscales.push_back(quantized.scales[i_value]); });
+			}
+			else
+			{
+				clip.first_value[ClipTracks::Rotation] = rotations.size();
+				clip.first_value[ClipTracks::Translation] = translations.size();
+				clip.first_value[ClipTracks::Scale] = scales.size();
+				AppendTracks(layout, ClipTracks::Rotation, frames, joints, [&](size_t i_value) { rotations.push_back(i_poses.rotations[i_value]); });
+				AppendTracks(layout, ClipTracks::Translation, frames, joints, [&](size_t i_value) { translations.push_back(i_poses.translations[i_value]); });
+				AppendTracks(layout, ClipTracks::Scale, frames, joints, [&](size_t i_value) { scales.push_back(i_poses.scales[i_value]); });
+			}
+		}
+		parents.insert(parents.end(), i_poses.parent_index.begin(), i_poses.parent_index.end());
+	}
+
+	// Only one of the two vertex sections gets data
+	std::vector<PackedMeshData> packed;
+	CookedData::Bounds bounds = {};
+	const bool pack = i_format == CookedData::VertexFormat::Packed;
+	if (pack)
+	{
+		VertexPacker::Pack(i_mesh, packed, bounds.min, bounds.max);
+	}
+
+	struct Payload
+	{
+		CookedData::SectionType type;
+		uint32_t                stride;
+		const void*             data;
+		uint64_t                count;
+	};
+
+	const Payload payloads[] =
+	{
+		{ CookedData::SectionType::Joint,      sizeof(CookedData::Joint),  joints.data(),      joints.size() },
+		{ CookedData::SectionType::Mesh,       sizeof(MeshData),           i_mesh.data(),      pack ? 0 : i_mesh.size() },
+		{ CookedData::SectionType::Index,      sizeof(int),                i_index.data(),     i_index.size() },
+		{ CookedData::SectionType::Clip,       sizeof(CookedData::Clip),   clips.data(),       clips.size() },
+		{ CookedData::SectionType::PoseRotation, sizeof(glm::quat),        rotations.data(),   rotations.size() },
+		{ CookedData::SectionType::PoseTranslation, sizeof(glm::vec3),     translations.data(), translations.size() },
+		{ CookedData::SectionType::PoseScale,  sizeof(float),              scales.data(),      scales.size() },
+		{ CookedData::SectionType::PoseParent, sizeof(int),                parents.data(),     parents.size() },
+		{ CookedData::SectionType::QuantizedRotation, sizeof(uint16_t),    quantizedrotations.data(), quantizedrotations.size() },
+		{ CookedData::SectionType::QuantizedTranslation, sizeof(uint16_t), quantizedtranslations.data(), quantizedtranslations.size() },
+		{ CookedData::SectionType::QuantizedScale, sizeof(uint16_t),       quantizedscales.data(), quantizedscales.size() },
+		{ CookedData::SectionType::TrackRange, sizeof(TrackRange),         ranges.data(),      ranges.size() },
+		{ CookedData::SectionType::KeyedJoint, sizeof(KeyedJoint),         keyedjoints.data(), keyedjoints.size() },
+		{ CookedData::SectionType::RotationFrame, sizeof(float),           rotationframes.data(), rotationframes.size() },
+		{ CookedData::SectionType::TranslationFrame, sizeof(float),        translationframes.data(), translationframes.size() },
+		{ CookedData::SectionType::ScaleFrame, sizeof(float),              scaleframes.data(), scaleframes.size() },
+		{ CookedData::SectionType::TrackBits,  sizeof(uint32_t),           trackbits.data(),   trackbits.size() },
+		{ CookedData::SectionType::BitRate,    sizeof(uint8_t),            bitrates.data(),    bitrates.size() },
+		{ CookedData::SectionType::VariableFrame, sizeof(uint32_t),        variableframes.data(), variableframes.size() },
+		{ CookedData::SectionType::SubMesh,    sizeof(SubMesh),            i_submeshes.data(), i_submeshes.size() },
+		{ CookedData::SectionType::Material,   sizeof(MaterialData),       i_materials.data(), i_materials.size() },
+		{ CookedData::SectionType::PackedMesh, sizeof(PackedMeshData),     packed.data(),      packed.size() },
+		{ CookedData::SectionType::MeshBounds, sizeof(CookedData::Bounds), &bounds,            pack ? 1u : 0u },
+		{ CookedData::SectionType::MeshLod,    sizeof(MeshLod),            i_lods.data(),      i_lods.size() },
+	};
+	const uint32_t section_count = sizeof(payloads) / sizeof(payloads[0]);
+
+	CookedData::Header header;
+	header.magic = CookedData::Magic;
+	header.version = CookedData::Version;
+	header.section_count = section_count;
+	header.padding = 0;
+
+	// Lay out the payloads after the section table
+	CookedData::Section sections[section_count];
+	uint64_t offset = AlignUp(sizeof(header) + sizeof(sections));
+	for (uint32_t i = 0; i < section_count; i++)
+	{
+		sections[i].type = payloads[i].type;
+		sections[i].stride = payloads[i].stride;
+		sections[i].offset = offset;
+		sections[i].count = payloads[i].count;
+		offset = AlignUp(offset + payloads[i].stride * payloads[i].count);
+	}
+
+	std::ofstream file(i_filepath, std::ios::binary | std::ios::trunc);
+	if (file.fail())
+	{
+		printf("Cannot open %s for cooking\n", i_filepath);
+		return false;
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(sections), sizeof(sections));
+
+	uint64_t written = sizeof(header) + sizeof(sections);
+	for (uint32_t i = 0; i < section_count; i++)
+	{
+		WritePadding(file, written, sections[i].offset);
+		uint64_t size = payloads[i].stride * payloads[i].count;
+		file.write(static_cast<const char*>(payloads[i].data), static_cast<std::streamsize>(size));
+		written = sections[i].offset + size;
+	}
+	WritePadding(file, written, AlignUp(written));
+
+	if (file.fail())
+	{
+		printf("Failed writing cooked file %s\n", i_filepath);
+		return false;
+	}
+
+	file.close();
+	return true;
+}
+
+bool CookedAsset::Load(const char* i_filepath)
+{
+	CleanUp();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(i_filepath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	filehandle = file;
+	mappinghandle = mapping;
+	mappedsize = static_cast<size_t>(size.QuadPart);
+	mapped = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	int file = open(i_filepath, O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+
+	struct stat status;
+	fstat(file, &status);
+	mappedsize = static_cast<size_t>(status.st_size);
+	mapped = mmap(nullptr, mappedsize, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (mapped == MAP_FAILED)
+	{
+		mapped = nullptr;
+	}
+#endif
+
+	if (!mapped || mappedsize < sizeof(CookedData::Header))
+	{
+		printf("Cannot map cooked file %s\n", i_filepath);
+		CleanUp();
+		return false;
+	}
+
+	const char* base = static_cast<const char*>(mapped);
+	const CookedData::Header* header = reinterpret_cast<const CookedData::Header*>(base);
+	if (header->magic != CookedData::Magic || header->version != CookedData::Version)
+	{
+		printf("Cooked file %s is out of date\n", i_filepath);
+		CleanUp();
+		return false;
+	}
+
+	const CookedData::Section* sections = reinterpret_cast<const CookedData::Section*>(base + sizeof(CookedData::Header));
+	if (sizeof(CookedData::Header) + header->section_count * sizeof(CookedData::Section) > mappedsize)
+	{
+		printf("Cooked file %s is truncated\n", i_filepath);
+		CleanUp();
+		return false;
+	}
+
+	// A clip has to fit in all three pose channels
+	size_t rotation_count = 0;
+	size_t translation_count = 0;
+	size_t scale_count = 0;
+	size_t quantizedrotation_count = 0;
+	size_t quantizedtranslation_count = 0;
+	size_t quantizedscale_count = 0;
+	size_t trackbit_count = 0;
+	size_t bitrate_count = 0;
+	size_t variableframe_count = 0;
+	size_t range_count = 0;
+	size_t keyedjoint_count = 0;
+	size_t rotationframe_count = 0;
+	size_t translationframe_count = 0;
+	size_t scaleframe_count = 0;
+	for (uint32_t i = 0; i < header->section_count; i++)
+	{
+		const CookedData::Section& section = sections[i];
+		if (section.offset + section.stride * section.count > mappedsize)
+		{
+			printf("Cooked file %s is truncated\n", i_filepath);
+			CleanUp();
+			return false;
+		}
+
+		const void* data = base + section.offset;
+		switch (section.type)
+		{
+		case CookedData::SectionType::Joint:
+			if (section.stride != sizeof(CookedData::Joint)) break;
+			joints = static_cast<const CookedData::Joint*>(data);
+			joint_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::Mesh:
+			if (section.stride != sizeof(MeshData)) break;
+			mesh = static_cast<const MeshData*>(data);
+			mesh_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::Index:
+			if (section.stride != sizeof(int)) break;
+			index = static_cast<const int*>(data);
+			index_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::Clip:
+			if (section.stride != sizeof(CookedData::Clip)) break;
+			clips = static_cast<const CookedData::Clip*>(data);
+			clip_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::PoseRotation:
+			if (section.stride != sizeof(glm::quat)) break;
+			rotations = static_cast<const glm::quat*>(data);
+			rotation_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::PoseTranslation:
+			if (section.stride != sizeof(glm::vec3)) break;
+			translations = static_cast<const glm::vec3*>(data);
+			translation_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::PoseScale:
+			if (section.stride != sizeof(float)) break;
+			scales = static_cast<const float*>(data);
+			scale_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::QuantizedRotation:
+			if (section.stride != sizeof(uint16_t)) break;
+			quantizedrotations = static_cast<const uint16_t*>(data);
+			quantizedrotation_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::QuantizedTranslation:
+			if (section.stride != sizeof(uint16_t)) break;
+			quantizedtranslations = static_cast<const uint16_t*>(data);
+			quantizedtranslation_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::QuantizedScale:
+			if (section.stride != sizeof(uint16_t)) break;
+			quantizedscales = static_cast<const uint16_t*>(data);
+			quantizedscale_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::TrackBits:
+			if (section.stride != sizeof(uint32_t)) break;
+			trackbits = static_cast<const uint32_t*>(data);
+			trackbit_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::BitRate:
+			if (section.stride != sizeof(uint8_t)) break;
+			bitrates = static_cast<const uint8_t*>(data);
+			bitrate_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::VariableFrame:
+			if (section.stride != sizeof(uint32_t)) break;
+			variableframes = static_cast<const uint32_t*>(data);
+			variableframe_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::TrackRange:
+			if (section.stride != sizeof(TrackRange)) break;
+			ranges = static_cast<const TrackRange*>(data);
+			range_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::KeyedJoint:
+			if (section.stride != sizeof(KeyedJoint)) break;
+			keyedjoints = static_cast<const KeyedJoint*>(data);
+			keyedjoint_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::RotationFrame:
+			if (section.stride != sizeof(float)) break;
+			rotationframes = static_cast<const float*>(data);
+			rotationframe_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::TranslationFrame:
+			if (section.stride != sizeof(float)) break;
+			translationframes = static_cast<const float*>(data);
+			translationframe_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::ScaleFrame:
+			if (section.stride != sizeof(float)) break;
+			scaleframes = static_cast<const float*>(data);
+			scaleframe_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::PoseParent:
+			if (section.stride != sizeof(int)) break;
+			parents = static_cast<const int*>(data);
+			parent_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::SubMesh:
+			if (section.stride != sizeof(SubMesh)) break;
+			submeshes = static_cast<const SubMesh*>(data);
+			submesh_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::Material:
+			if (section.stride != sizeof(MaterialData)) break;
+			materials = static_cast<const MaterialData*>(data);
+			material_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::PackedMesh:
+			if (section.stride != sizeof(PackedMeshData)) break;
+			packedmesh = section.count ? static_cast<const PackedMeshData*>(data) : nullptr;
+			packedmesh_count = static_cast<size_t>(section.count);
+			continue;
+		case CookedData::SectionType::MeshBounds:
+			if (section.stride != sizeof(CookedData::Bounds)) break;
+			meshbounds = section.count ? static_cast<const CookedData::Bounds*>(data) : nullptr;
+			continue;
+		case CookedData::SectionType::MeshLod:
+			if (section.stride != sizeof(MeshLod)) break;
+			lods = section.count ? static_cast<const MeshLod*>(data) : nullptr;
+			lod_count = static_cast<size_t>(section.count);
+			continue;
+		default:
+			// Unknown sections are skipped
+			continue;
+		}
+
+		printf("Cooked file %s was cooked with a different data layout\n", i_filepath);
+		CleanUp();
+		return false;
+	}
+
+	if (packedmesh && !meshbounds)
+	{
+		printf("Cooked file %s has packed vertices without bounds\n", i_filepath);
+		CleanUp();
+		return false;
+	}
+
+	for (size_t i = 0; i < submesh_count; i++)
+	{
+		if (submeshes[i].index_offset < 0 || static_cast<size_t>(submeshes[i].index_offset) + submeshes[i].index_count > index_count
+			|| submeshes[i].influence_count < 0 || submeshes[i].influence_count > 4)
+		{
+			printf("Cooked file %s has a broken submesh table\n", i_filepath);
+			CleanUp();
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < lod_count; i++)
+	{
+		if (lods[i].submesh_offset < 0 || lods[i].submesh_count < 0 || static_cast<size_t>(lods[i].submesh_offset) + lods[i].submesh_count > submesh_count)
+		{
+			printf("Cooked file %s has a broken lod table\n", i_filepath);
+			CleanUp();
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < clip_count; i++)
+	{
+		const CookedData::Clip& clip = clips[i];
+		const uint64_t last_parent = clip.first_parent + static_cast<uint64_t>(clip.joint_count);
+		const bool quantized = clip.format == ClipFormat::Quantized48 || clip.format == ClipFormat::Quantized32;
+		const bool variable = clip.format == ClipFormat::Variable;
+		bool fits;
+		switch (clip.format)
+		{
+		case ClipFormat::Float:
+		case ClipFormat::Quantized48:
+		case ClipFormat::Quantized32:
+		case ClipFormat::Variable:
+		{
+			// Values of every channel, counted in whole values
+			const uint64_t value_count[3] =
+			{
+				quantized ? quantizedrotation_count / ClipCompressor::RotationWords(clip.format) : rotation_count,
+				quantized ? quantizedtranslation_count / 3 : translation_count,
+				quantized ? quantizedscale_count : scale_count,
+			};
+			const int words = ClipTracks::Words(clip.joint_count);
+			// Variable bit rate clips keep only their constant tracks in the value sections
+			const uint64_t stored_frames = variable ? 0 : static_cast<uint64_t>(clip.frame_count);
+			fits = clip.joint_count >= 0 && clip.first_bits + 6 * static_cast<uint64_t>(words) <= trackbit_count && (!(quantized || variable) || last_parent <= range_count);
+			for (int channel = 0; channel < 3 && fits; channel++)
+			{
+				const uint32_t* bits = trackbits + clip.first_bits;
+				fits = clip.animated_count[channel] == CountBits(ClipTracks::Animated(bits, clip.joint_count, channel), words)
+					&& clip.constant_count[channel] == CountBits(ClipTracks::Constant(bits, clip.joint_count, channel), words)
+					&& clip.first_value[channel] + clip.constant_count[channel] + stored_frames * clip.animated_count[channel] <= value_count[channel];
+			}
+
+			// Every bit rate has to be one the sampler reads and a frame has to hold all of its tracks, plus the padding word after the last frame
+			if (fits && variable)
+			{
+				fits = clip.first_rate + clip.animated_count[0] + clip.animated_count[1] + clip.animated_count[2] <= bitrate_count
+					&& clip.first_frame + static_cast<uint64_t>(clip.frame_count) * clip.frame_words + 1 <= variableframe_count;
+				uint64_t frame_bits = 0;
+				const uint8_t* rate = bitrates + clip.first_rate;
+				for (int channel = 0; channel < 3 && fits; channel++)
+				{
+					for (int t = 0; t < clip.animated_count[channel] && fits; t++, rate++)
+					{
+						fits = *rate >= ClipBitRate::LowestBits && *rate <= ClipBitRate::HighestBits;
+						frame_bits += channel == ClipTracks::Rotation ? 2 + 3 * *rate : (channel == ClipTracks::Translation ? 3 * *rate : *rate);
+					}
+				}
+				fits = fits && frame_bits <= 32 * static_cast<uint64_t>(clip.frame_words);
+			}
+			break;
+		}
+		case ClipFormat::Keyed:
+			fits = last_parent <= keyedjoint_count;
+			for (uint64_t j = clip.first_parent; j < last_parent && fits; j++)
+			{
+				// Animated channels have at least the first and last frame as keys, constant ones one key and bind pose ones none
+				const KeyedJoint& keys = keyedjoints[j];
+				fits = static_cast<uint64_t>(keys.rotation_first) + keys.rotation_count <= std::min(rotation_count, rotationframe_count)
+					&& static_cast<uint64_t>(keys.translation_first) + keys.translation_count <= std::min(translation_count, translationframe_count)
+					&& static_cast<uint64_t>(keys.scale_first) + keys.scale_count <= std::min(scale_count, scaleframe_count);
+			}
+			break;
+		default:
+			fits = false;
+			break;
+		}
+
+		if (clip.frame_count < 0 || clip.joint_count < 0 || !fits || last_parent > parent_count)
+		{
+			printf("Cooked file %s has a broken clip table\n", i_filepath);
+			CleanUp();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void CookedAsset::CleanUp()
+{
+#ifdef _WIN32
+	if (mapped)
+	{
+		UnmapViewOfFile(mapped);
+	}
+	if (mappinghandle)
+	{
+		CloseHandle(static_cast<HANDLE>(mappinghandle));
+	}
+	if (filehandle)
+	{
+		CloseHandle(static_cast<HANDLE>(filehandle));
+	}
+	mappinghandle = nullptr;
+	filehandle = nullptr;
+#else
+	if (mapped)
+	{
+		munmap(mapped, mappedsize);
+	}
+#endif
+
+	mapped = nullptr;
+	mappedsize = 0;
+
+	joints = nullptr;
+	mesh = nullptr;
+	index = nullptr;
+	clips = nullptr;
+	rotations = nullptr;
+	translations = nullptr;
+	scales = nullptr;
+	parents = nullptr;
+	ranges = nullptr;
+	quantizedrotations = nullptr;
+	quantizedtranslations = nullptr;
+	quantizedscales = nullptr;
+	keyedjoints = nullptr;
+	rotationframes = nullptr;
+	translationframes = nullptr;
+	scaleframes = nullptr;
+	trackbits = nullptr;
+	bitrates = nullptr;
+	variableframes = nullptr;
+	submeshes = nullptr;
+	materials = nullptr;
+	packedmesh = nullptr;
+	meshbounds = nullptr;
+	lods = nullptr;
+	joint_count = mesh_count = index_count = clip_count = parent_count = submesh_count = material_count = packedmesh_count = lod_count = 0;
+}
+
+void CookedAsset::ToSkeleton(Skeleton& o_skeleton) const
+{
+	o_skeleton.joints.resize(joint_count);
+	for (size_t i = 0; i < joint_count; i++)
+	{
+		o_skeleton.joints[i].inversed = joints[i].inversed;
+		o_skeleton.joints[i].coord = joints[i].coord;
+		o_skeleton.joints[i].name = joints[i].name;
+		o_skeleton.joints[i].parent_index = joints[i].parent_index;
+	}
+}
+
+ClipView CookedAsset::GetClip(size_t i_clip) const
+{
+	const CookedData::Clip& clip = clips[i_clip];
+	ClipView view;
+	view.frame_count = clip.frame_count;
+	view.joint_count = clip.joint_count;
+	view.is_looping = clip.is_looping != 0;
+	view.parent_index = parents + clip.first_parent;
+	view.format = clip.format;
+	const bool keyed = clip.format == ClipFormat::Keyed;
+	const bool variable = clip.format == ClipFormat::Variable;
+	const bool quantized = !keyed && !variable && clip.format != ClipFormat::Float;
+	view.track_bits = keyed ? nullptr : trackbits + clip.first_bits;
+	for (int channel = 0; channel < 3; channel++)
+	{
+		view.animated_count[channel] = clip.animated_count[channel];
+		view.constant_count[channel] = clip.constant_count[channel];
+	}
+
+	// Keyed clips index the whole sections through their KeyedJoint
+	const uint64_t* first = clip.first_value;
+	view.rotations = quantized ? nullptr : rotations + first[ClipTracks::Rotation];
+	view.translations = quantized ? nullptr : translations + first[ClipTracks::Translation];
+	view.scales = quantized ? nullptr : scales + first[ClipTracks::Scale];
+	view.ranges = quantized || variable ? ranges + clip.first_parent : nullptr;
+	view.packed_rotations = quantized ? quantizedrotations + first[ClipTracks::Rotation] * ClipCompressor::RotationWords(clip.format) : nullptr;
+	view.packed_translations = quantized ? quantizedtranslations + first[ClipTracks::Translation] * 3 : nullptr;
+	view.packed_scales = quantized ? quantizedscales + first[ClipTracks::Scale] : nullptr;
+	view.bit_rates = variable ? bitrates + clip.first_rate : nullptr;
+	view.packed_frames = variable ? variableframes + clip.first_frame : nullptr;
+	view.frame_words = variable ? clip.frame_words : 0;
+	view.keyed_joints = keyed ? keyedjoints + clip.first_parent : nullptr;
+	view.rotation_frames = rotationframes;
+	view.translation_frames = translationframes;
+	view.scale_frames = scaleframes;
+	return view;
+}
+
+void CookedAsset::GetBindPose(glm::quat* o_rotations, glm::vec3* o_translations, float* o_scales) const
+{
+	for (size_t j = 0; j < joint_count; j++)
+	{
+		glm::mat4 local = glm::inverse(joints[j].inversed);
+		if (joints[j].parent_index >= 0)
+		{
+			local = joints[joints[j].parent_index].inversed * local;
+		}
+		ClipSampler::DecomposePose(local, o_rotations[j], o_translations[j], o_scales[j]);
+	}
+}
@@ -0,0 +1,182 @@
+#pragma once
+#include "SceneProxy.h"
+#include "ClipCompressor.h"
+#include <cstdint>
+
+// Cooked asset file layout
+// [Header][Section table][Section payloads, each aligned to CookedData::Alignment]
+// Payloads are stored exactly as the runtime uses them, so a mapped file can be used in place.
+namespace CookedData
+{
+	const uint32_t Magic     = 0x4B4F4F43; // "COOK"
+	const uint32_t Version   = 13;
+	const uint32_t Alignment = 64;
+
+	// Bump when the importer produces different data from the same fbx file. The batch cooker recooks everything
+	// when either this or Version changed.
+	const uint32_t ImporterVersion = 8;
+
+	enum class SectionType : uint32_t
+	{
+		Joint      = 0,
+		Mesh       = 1,
+		Index      = 2,
+		Clip       = 3,
+		PoseRotation = 4,
+		SubMesh    = 5,
+		Material   = 6,
+		PackedMesh = 7,
+		MeshBounds = 8,
+		MeshLod    = 9,
+		PoseTranslation = 10,
+		PoseScale  = 11,
+		PoseParent = 12,
+		QuantizedRotation    = 13,
+		QuantizedTranslation = 14,
+		QuantizedScale       = 15,
+		TrackRange = 16,
+		KeyedJoint = 17,
+		RotationFrame    = 18,
+		TranslationFrame = 19,
+		ScaleFrame = 20,
+		TrackBits  = 21,
+		BitRate    = 22,
+		VariableFrame = 23,
+	};
+
+	// Full writes MeshData, Packed writes PackedMeshData and the bounds needed to decode the positions
+	enum class VertexFormat : uint32_t
+	{
+		Full   = 0,
+		Packed = 1,
+	};
+
+	struct Bounds
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t section_count;
+		uint32_t padding;
+	};
+
+	struct Section
+	{
+		SectionType type;
+		uint32_t    stride; // sizeof one element, used to reject files cooked with a different layout
+		uint64_t    offset; // from the beginning of the file
+		uint64_t    count;
+	};
+
+	struct Joint
+	{
+		glm::mat4 inversed;
+		glm::vec3 coord;
+		int       parent_index;
+		char      name[64];
+	};
+
+	// A dense clip stores the constant tracks of a channel from first_value on in that channel's section of its format,
+	// followed by the animated tracks of every frame, and its track bits from first_bits on in the TrackBits section.
+	// The parent, TrackRange or KeyedJoint of every joint is stored from first_parent on. Every clip of a file has the same format.
+	// Keyed clips keep their keys in the float pose sections and the frame of every key, fractional for curve keys,
+	// in the frame sections, both indexed by their KeyedJoint.
+	// Variable bit rate clips keep only their constant tracks in the float sections and their ranges from first_parent on,
+	// the bit rates of their animated tracks from first_rate on and frame_words words a frame from first_frame on.
+	struct Clip
+	{
+		uint64_t   first_value[3]; // rotation, translation and scale, in values
+		uint64_t   first_parent;
+		uint64_t   first_bits;
+		uint64_t   first_rate;
+		uint64_t   first_frame;
+		int        frame_count;
+		int        joint_count;
+		int        animated_count[3];
+		int        constant_count[3];
+		float      frame_per_second;
+		uint32_t   is_looping;
+		ClipFormat format;
+		uint32_t   frame_words;
+		char       name[64];
+	};
+}
+
+class CookedAsset
+{
+public:
+	CookedAsset() = default;
+	~CookedAsset();
+
+	CookedAsset(const CookedAsset&) = delete;
+	CookedAsset& operator=(const CookedAsset&) = delete;
+
+	// Write the imported data to a cooked file
+	static bool Cook(const char* i_filepath, const Skeleton& i_skeleton, const std::vector<MeshData>& i_mesh, const std::vector<int>& i_index,
+		const std::vector<SubMesh>& i_submeshes, const std::vector<MeshLod>& i_lods, const std::vector<MaterialData>& i_materials, const AnimationClip& i_clip, CookedData::VertexFormat i_format = CookedData::VertexFormat::Full, ClipFormat i_clipformat = ClipFormat::Float);
+	static bool Cook(const char* i_filepath, const Skeleton& i_skeleton, const std::vector<MeshData>& i_mesh, const std::vector<int>& i_index,
+		const std::vector<SubMesh>& i_submeshes, const std::vector<MeshLod>& i_lods, const std::vector<MaterialData>& i_materials, const AnimationClip* i_clips, size_t i_clipcount, CookedData::VertexFormat i_format = CookedData::VertexFormat::Full, ClipFormat i_clipformat = ClipFormat::Float);
+
+	// Map a cooked file and point the arrays below into it
+	bool Load(const char* i_filepath);
+	void CleanUp();
+
+	// Joint names are the only thing that have to be copied out
+	void ToSkeleton(Skeleton& o_skeleton) const;
+
+	// Sampled through ClipSampler
+	ClipView GetClip(size_t i_clip) const;
+
+	// Local bind pose of every joint, which the sampler leaves in place for tracks that hold it
+	void GetBindPose(glm::quat* o_rotations, glm::vec3* o_translations, float* o_scales) const;
+
+public:
+	const CookedData::Joint* joints = nullptr;
+	const MeshData*          mesh = nullptr;
+	const int*               index = nullptr;
+	const CookedData::Clip*  clips = nullptr;
+	const glm::quat*         rotations = nullptr;
+	const glm::vec3*         translations = nullptr;
+	const float*             scales = nullptr;
+	const int*               parents = nullptr;
+	const TrackRange*        ranges = nullptr;                // quantized and variable bit rate clips, one per joint like parents
+	const uint16_t*          quantizedrotations = nullptr;
+	const uint16_t*          quantizedtranslations = nullptr;
+	const uint16_t*          quantizedscales = nullptr;
+	const KeyedJoint*        keyedjoints = nullptr;          // keyed clips, one per joint like parents
+	const float*             rotationframes = nullptr;
+	const float*             translationframes = nullptr;
+	const float*             scaleframes = nullptr;
+	const uint32_t*          trackbits = nullptr;
+	const uint8_t*           bitrates = nullptr;
+	const uint32_t*          variableframes = nullptr;
+	const SubMesh*           submeshes = nullptr;
+	const MaterialData*      materials = nullptr;
+	const PackedMeshData*    packedmesh = nullptr;   // set instead of mesh for VertexFormat::Packed
+	const CookedData::Bounds* meshbounds = nullptr;
+	const MeshLod*           lods = nullptr;         // runs of the submesh table, finest first
+
+	size_t joint_count = 0;
+	size_t mesh_count = 0;
+	size_t index_count = 0;
+	size_t clip_count = 0;
+	size_t parent_count = 0;
+	size_t submesh_count = 0;
+	size_t material_count = 0;
+	size_t packedmesh_count = 0;
+	size_t lod_count = 0;
+
+private:
+	void*  mapped = nullptr;
+	size_t mappedsize = 0;
+
+#ifdef _WIN32
+	void*  filehandle = nullptr;
+	void*  mappinghandle = nullptr;
+#endif
+};
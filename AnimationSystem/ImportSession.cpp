@@ -0,0 +1,93 @@
+#include "ImportSession.h"
+#include "Profiler.h"
+
+ImportSession::ImportSession()
+{
+	thread = std::thread(&ImportSession::Work, this);
+}
+
+ImportSession::~ImportSession()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+	thread.join();
+}
+
+std::future<ImportedFile> ImportSession::Import(const std::string& i_filepath, ImportScope i_scope, AnimationImportMode i_mode)
+{
+	Request request;
+	request.path = i_filepath;
+	request.scope = i_scope;
+	request.mode = i_mode;
+	std::future<ImportedFile> result = request.result.get_future();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		requests.push(std::move(request));
+	}
+	condition.notify_one();
+
+	return result;
+}
+
+void ImportSession::Work()
+{
+	// The manager and its IO settings are made on the session thread, so the constructor returns right away
+	const std::string name = "import session";
+	FbxManager* manager;
+	{
+		ProfileScope scope("FBX manager", name);
+		manager = Importer::CreateManager();
+	}
+
+	while (true)
+	{
+		Request request;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return stopping || !requests.empty(); });
+			if (requests.empty())
+			{
+				break;
+			}
+			request = std::move(requests.front());
+			requests.pop();
+		}
+
+		request.result.set_value(Load(manager, request));
+	}
+
+	Importer::DestroyManager(manager);
+}
+
+ImportedFile ImportSession::Load(FbxManager* i_manager, const Request& i_request)
+{
+	ImportedFile file;
+	file.path = i_request.path;
+
+	Importer fbx;
+	if (!fbx.Init(i_manager, i_request.path.c_str(), i_request.scope))
+	{
+		return file;
+	}
+
+	fbx.ImportSkeletonMeshData(file.skeleton);
+	if (i_request.scope == ImportScope::Everything)
+	{
+		fbx.ImportMeshData(file.mesh, file.index, file.submeshes, file.skeleton);
+		fbx.ImportMaterialData(file.materials);
+	}
+	fbx.ImportAnimationClips(file.clips, i_request.mode);
+	fbx.CleanUp();
+
+	for (AnimationClip& clip : file.clips)
+	{
+		clip.pSkeleton = nullptr;
+	}
+
+	file.loaded = true;
+	return file;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "Importer.h"
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+
+// Everything imported from one fbx file. Clips do not point at the skeleton yet, the file is moved around by value.
+struct ImportedFile
+{
+	std::string                path;
+	bool                       loaded = false;
+	Skeleton                   skeleton;
+	std::vector<MeshData>      mesh;
+	std::vector<int>           index;
+	std::vector<SubMesh>       submeshes;
+	std::vector<MaterialData>  materials;
+	std::vector<AnimationClip> clips;
+};
+
+// Imports queued files one after another on a thread of its own, with one FbxManager for the whole session
+// instead of one per file. The caller gets a future per file and can do other work while they load.
+// A manager must not be used by two threads at once, sessions that should load side by side each have their own.
+class ImportSession
+{
+public:
+	ImportSession();
+	// Finishes the files still queued
+	~ImportSession();
+
+	ImportSession(const ImportSession&) = delete;
+	ImportSession& operator=(const ImportSession&) = delete;
+
+	// AnimationOnly reads the skeleton and the clips, everything else also the meshes and materials
+	std::future<ImportedFile> Import(const std::string& i_filepath, ImportScope i_scope = ImportScope::Everything, AnimationImportMode i_mode = AnimationImportMode::Resample);
+
+private:
+	struct Request
+	{
+		std::string                path;
+		ImportScope                scope;
+		AnimationImportMode        mode;
+		std::promise<ImportedFile> result;
+	};
+
+	void Work();
+	ImportedFile Load(FbxManager* i_manager, const Request& i_request);
+
+	std::thread             thread;
+	std::queue<Request>     requests;
+	std::mutex              mutex;
+	std::condition_variable condition;
+	bool                    stopping = false;
+};
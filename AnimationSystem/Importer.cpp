@@ -1,56 +1,223 @@
 #include "Importer.h"
+#include "ClipSampler.h"
+#include "MeshOptimizer.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+#include "Triangulator.h"
 #include <cmath>
 #include <glm/gtx/euler_angles.hpp>
 #include <iostream>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/matrix_decompose.hpp>
+#include <algorithm>
+#include <mutex>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define FBXSDK_SHARED
 
-FbxManager* Importer::lSdkManager = nullptr;
-FbxScene* Importer::lScene  = nullptr;
-FbxNode* Importer::lRootNode = nullptr;
-std::multimap<int, BlendingWeight> Importer::WeightMap;
+namespace
+{
+	// Convert a packed double array to floats, two values per instruction where SSE2 is available
+	void ConvertToFloat(const double* i_source, float* o_target, size_t i_count)
+	{
+		size_t i = 0;
+#if defined(_M_X64) || defined(__SSE2__)
+		for (; i + 4 <= i_count; i += 4)
+		{
+			__m128 low = _mm_cvtpd_ps(_mm_loadu_pd(i_source + i));
+			__m128 high = _mm_cvtpd_ps(_mm_loadu_pd(i_source + i + 2));
+			_mm_storeu_ps(o_target + i, _mm_movelh_ps(low, high));
+		}
+#endif
+		for (; i < i_count; i++)
+		{
+			o_target[i] = (float)i_source[i];
+		}
+	}
+
+	// Gather i_components floats per polygon vertex from a normal or UV layer element.
+	// The direct array is converted in one go and then looked up through the mapping and reference mode,
+	// instead of asking the SDK for every corner.
+	template <class Value>
+	bool ExtractLayerElement(FbxLayerElementTemplate<Value>* i_element, FbxMesh* i_mesh, int i_components, std::vector<float>& o_values)
+	{
+		if (!i_element)
+		{
+			return false;
+		}
+
+		const int stride = sizeof(Value) / sizeof(double);
+		FbxLayerElementArrayTemplate<Value>& directArray = i_element->GetDirectArray();
+		FbxLayerElementArrayReadLock<Value> directLock(directArray);
+		if (!directLock.GetData())
+		{
+			return false;
+		}
+
+		int directCount = directArray.GetCount();
+		std::vector<float> direct((size_t)directCount * stride);
+		ConvertToFloat(reinterpret_cast<const double*>(directLock.GetData()), direct.data(), direct.size());
+
+		// eIndex is treated like eIndexToDirect, as the SDK does
+		bool indexed = i_element->GetReferenceMode() != FbxLayerElement::eDirect;
+		FbxLayerElementArrayReadLock<int> indexLock(i_element->GetIndexArray());
+		const int* indices = indexed ? indexLock.GetData() : nullptr;
+		int indexCount = indexed ? i_element->GetIndexArray().GetCount() : 0;
+		if (indexed && !indices)
+		{
+			return false;
+		}
+
+		FbxLayerElement::EMappingMode mapping = i_element->GetMappingMode();
+		if (mapping != FbxLayerElement::eByControlPoint && mapping != FbxLayerElement::eByPolygonVertex &&
+			mapping != FbxLayerElement::eByPolygon && mapping != FbxLayerElement::eAllSame)
+		{
+			return false;
+		}
+
+		const int* polygonVertices = i_mesh->GetPolygonVertices();
+		int cornerCount = i_mesh->GetPolygonVertexCount();
+
+		// Polygons are no longer all triangles, so eByPolygon needs the polygon of every corner
+		std::vector<int> polygonOfCorner;
+		if (mapping == FbxLayerElement::eByPolygon)
+		{
+			polygonOfCorner.resize(cornerCount);
+			for (int polygon = 0; polygon < i_mesh->GetPolygonCount(); polygon++)
+			{
+				int first = i_mesh->GetPolygonVertexIndex(polygon);
+				std::fill(polygonOfCorner.begin() + first, polygonOfCorner.begin() + first + i_mesh->GetPolygonSize(polygon), polygon);
+			}
+		}
+
+		o_values.assign((size_t)cornerCount * i_components, 0.0f);
+		for (int corner = 0; corner < cornerCount; corner++)
+		{
+			int element = 0;
+			switch (mapping)
+			{
+			case FbxLayerElement::eByControlPoint: element = polygonVertices[corner]; break;
+			case FbxLayerElement::eByPolygonVertex: element = corner; break;
+			case FbxLayerElement::eByPolygon: element = polygonOfCorner[corner]; break;
+			default: break;
+			}
+
+			if (indexed)
+			{
+				element = element < indexCount ? indices[element] : -1;
+			}
+			if (element < 0 || element >= directCount)
+			{
+				continue;
+			}
 
-bool Importer::Init(const char * i_filepath)
+			for (int component = 0; component < i_components; component++)
+			{
+				o_values[(size_t)corner * i_components + component] = direct[(size_t)element * stride + component];
+			}
+		}
+
+		return true;
+	}
+
+	// Creating and destroying a manager registers and releases the SDK plugins, which is not thread safe.
+	// Everything else only touches the objects owned by one manager.
+	std::mutex ManagerMutex;
+}
+
+Importer::~Importer()
+{
+	CleanUp();
+}
+
+bool Importer::Init(const char * i_filepath, ImportScope i_scope)
 {
-	// Change the following filename to a suitable filename value.
-	const char* lFilename = i_filepath;
+	CleanUp();
 
+	filepath = i_filepath;
+	{
+		ProfileScope scope("FBX manager", filepath);
+		lSdkManager = CreateManager();
+		ownsManager = true;
+	}
+
+	return LoadScene(i_filepath, i_scope);
+}
+
+bool Importer::Init(FbxManager* i_manager, const char* i_filepath, ImportScope i_scope)
+{
+	CleanUp();
+
+	filepath = i_filepath;
+	lSdkManager = i_manager;
+	ownsManager = false;
+
+	return LoadScene(i_filepath, i_scope);
+}
+
+FbxManager* Importer::CreateManager()
+{
 	// Initialize the SDK manager. This object handles memory management.
-	lSdkManager = FbxManager::Create();
+	FbxManager* manager;
+	{
+		std::lock_guard<std::mutex> lock(ManagerMutex);
+		Profiler::InstallFbxAllocator();
+		manager = FbxManager::Create();
+	}
 
 	// Create the IO settings object.
-	FbxIOSettings* ios = FbxIOSettings::Create(lSdkManager, IOSROOT);
-	lSdkManager->SetIOSettings(ios);
+	FbxIOSettings* ios = FbxIOSettings::Create(manager, IOSROOT);
+	manager->SetIOSettings(ios);
+	return manager;
+}
+
+void Importer::DestroyManager(FbxManager* i_manager)
+{
+	// Destroy the SDK manager and all the other objects it was handling.
+	std::lock_guard<std::mutex> lock(ManagerMutex);
+	i_manager->Destroy();
+}
+
+bool Importer::LoadScene(const char* i_filepath, ImportScope i_scope)
+{
+	ProfileScope scope("FBX parse", filepath);
+
+	// Only joints and curves are read from animation files. A shared manager keeps its settings, so they are always set.
+	FbxIOSettings* ios = lSdkManager->GetIOSettings();
+	bool everything = i_scope == ImportScope::Everything;
+	ios->SetBoolProp(IMP_FBX_MATERIAL, everything);
+	ios->SetBoolProp(IMP_FBX_TEXTURE, everything);
+	ios->SetBoolProp(IMP_FBX_SHAPE, everything);
 
 	// Create an importer using the SDK manager.
 	FbxImporter* lImporter = FbxImporter::Create(lSdkManager, "");
 
 	// Use the first argument as the filename for the importer.
-	if (!lImporter->Initialize(lFilename, -1, lSdkManager->GetIOSettings()))
+	if (!lImporter->Initialize(i_filepath, -1, ios))
 	{
 		printf("Call to FbxImporter::Initialize() failed.\n");
 		printf("Error returned: %s\n\n", lImporter->GetStatus().GetErrorString());
-		exit(-1);
+		lImporter->Destroy();
+		CleanUp();
+		return false;
 	}
 
 	// Create a new scene so that it can be populated by the imported file.
-	Importer::lScene = FbxScene::Create(lSdkManager, "myScene");
+	lScene = FbxScene::Create(lSdkManager, "myScene");
 
 	// Import the contents of the file into the scene.
-	lImporter->Import(Importer::lScene);
+	lImporter->Import(lScene);
 
 	// The file is imported, so get rid of the importer.
 	lImporter->Destroy();
 
 	
-	Importer::lRootNode = Importer::lScene->GetRootNode();
-
-	FbxGeometryConverter geometryConverter(lSdkManager);
-	geometryConverter.Triangulate(lScene, true);
-	//geometryConverter.SplitMeshesPerMaterial(Importer::lScene, true);
+	lRootNode = lScene->GetRootNode();
 
+	// Polygons are triangulated per mesh in ImportMeshData, animation only imports never touch the geometry
 	return true;
 }
 
@@ -59,32 +226,84 @@ void Importer::PrintData()
 	// Print the nodes of the scene and their attributes recursively.
 	// Note that we are not printing the root node because it should
 	// not contain any attributes.
-	if (Importer::lRootNode)
+	if (lRootNode)
 	{
-		for (int i = 0; i < Importer::lRootNode->GetChildCount(); i++)
-			PrintNode(Importer::lRootNode->GetChild(i));
+		for (int i = 0; i < lRootNode->GetChildCount(); i++)
+			PrintNode(lRootNode->GetChild(i));
 	}
 }
 
 bool Importer::CleanUp()
 {
-	// Destroy the SDK manager and all the other objects it was handling.
-	lSdkManager->Destroy();
+	if (lSdkManager && ownsManager)
+	{
+		DestroyManager(lSdkManager);
+	}
+	else if (lScene)
+	{
+		// A borrowed manager stays, only the scene of this file goes
+		lScene->Destroy();
+	}
+	lSdkManager = nullptr;
+	ownsManager = false;
+	lScene = nullptr;
+	lRootNode = nullptr;
+
+	// Nodes are gone with the scene
+	JointNodeMap.clear();
+	JointNameMap.clear();
 
 	return true;
 }
 
-bool Importer::ImportMeshData(std::vector<MeshData>& mesh, std::vector<int>& index, Skeleton& skeleton)
+bool Importer::ImportMeshData(std::vector<MeshData>& mesh, std::vector<int>& index, std::vector<SubMesh>& submeshes, Skeleton& skeleton)
 {
+	// The skeleton may come from another file, only names can be matched then
+	if (JointNameMap.empty())
+	{
+		BuildJointMap(skeleton);
+	}
+
+	// Material ids are the scene material order, the same order ImportMaterialData returns
+	std::unordered_map<FbxSurfaceMaterial*, int> materialIds;
+	for (int i = 0; i < lScene->GetMaterialCount(); ++i)
+	{
+		materialIds.emplace(lScene->GetMaterial(i), i);
+	}
+
 	//Get mesh in the scene
-	int meshCount = Importer::lScene->GetSrcObjectCount<FbxMesh>();
+	int meshCount = lScene->GetSrcObjectCount<FbxMesh>();
+
+	// Triangle corners of every mesh, as polygon vertex numbers, and the polygon every triangle came from.
+	// Meshes only read their own data here
+	std::vector<std::vector<int>> triangles(meshCount);
+	std::vector<std::vector<int>> trianglePolygons(meshCount);
+	ThreadPool::Get().ParallelFor(0, meshCount, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			ProfileScope scope("Triangulation", filepath);
+			TriangulateMesh(lScene->GetSrcObject<FbxMesh>(i), triangles[i], trianglePolygons[i]);
+		}
+	});
+
+	// Triangles are collected per mesh and material first, the index buffer is laid out by material at the end
+	std::vector<SubMesh> groups;
+	std::vector<std::vector<int>> groupIndices;
 
 	for (int i = 0; i < meshCount; ++i)
 	{
-		FbxMesh* pMesh = Importer::lScene->GetSrcObject<FbxMesh>(i);
+		FbxMesh* pMesh = lScene->GetSrcObject<FbxMesh>(i);
+		const std::vector<int>& corners = triangles[i];
+
+		// Store skin data per control point
+		std::vector<glm::ivec4> skin_index;
+		std::vector<glm::vec4> skin_weight;
+		ImportSkinWeights(pMesh, skin_index, skin_weight);
+
+		ProfileScope scope("Vertex emit", filepath);
 
 		FbxNode* pNode = pMesh->GetNode();
-		FbxAMatrix geometryTransform = GetGeometryTransformation(pNode);
 
 		glm::mat4 model_matrix = glm::mat4(1.0);
 
@@ -106,255 +325,824 @@ bool Importer::ImportMeshData(std::vector<MeshData>& mesh, std::vector<int>& ind
 		// Get vertex array
 		FbxVector4* vertex_array = pMesh->GetControlPoints();
 
-		// Get normal array
-		FbxArray< FbxVector4 > normal_array;
-		pMesh->GetPolygonVertexNormals(normal_array);
+		int cornerCount = (int)corners.size();
+
+		// Get normals and the first UV set per polygon vertex, read in bulk from the layer elements
+		if (!pMesh->GetElementNormal(0))
+		{
+			pMesh->GenerateNormals();
+		}
+		std::vector<float> normals, uvs;
+		if (!ExtractLayerElement(pMesh->GetElementNormal(0), pMesh, 3, normals))
+		{
+			printf("Unsupported normal mapping on %s\n", pNode->GetName());
+			normals.assign(pMesh->GetPolygonVertexCount() * 3, 0.0f);
+		}
+		if (!ExtractLayerElement(pMesh->GetElementUV(0), pMesh, 2, uvs))
+		{
+			uvs.assign(pMesh->GetPolygonVertexCount() * 2, 0.0f);
+		}
+
+		// Get the material of every triangle
+		std::vector<int> materials;
+		ImportTriangleMaterials(pMesh, trianglePolygons[i], materialIds, materials);
 
-		// Get UV layer names
-		FbxStringList uvsetName;
-		pMesh->GetUVSetNames(uvsetName);
+		// Current vertex count
+		int n = 0 + (int)mesh.size();
 
-		// Store skin data
-		unsigned int numOfDeformers = pMesh->GetDeformerCount();
+		// Submesh of this mesh for every material it uses
+		std::unordered_map<int, size_t> meshGroups;
 
-		// A deformer is a FBX thing, which contains some clusters
-		// A cluster contains a link, which is basically a joint
-		// Normally, there is only one deformer in a mesh
-		for (unsigned int deformerIndex = 0; deformerIndex < numOfDeformers; ++deformerIndex)
+		mesh.reserve(mesh.size() + cornerCount);
+		for (int j = 0; j < cornerCount; j++)
 		{
-			// There are many types of deformers in Maya,
-			// We are using only skins, so we see if this is a skin
-			FbxSkin* currSkin = reinterpret_cast<FbxSkin*>(pMesh->GetDeformer(deformerIndex, FbxDeformer::eSkin));
-			if (!currSkin)
+			int corner = corners[j];
+			int controlPoint = index_array[corner];
+
+			MeshData p;
+			const FbxVector4& position = vertex_array[controlPoint];
+			p.vertex = model_matrix * glm::vec4((float)position.mData[0], (float)position.mData[1], (float)position.mData[2], 1.0);
+			p.normal = model_inverse_transpose_matrix * glm::vec4(normals[3 * corner + 0], normals[3 * corner + 1], normals[3 * corner + 2], 1.0);
+			p.uv = glm::vec2(uvs[2 * corner + 0], uvs[2 * corner + 1]);
+
+			// Get skin info from the control points
+			p.index = skin_index[controlPoint];
+			p.weight = skin_weight[controlPoint];
+
+			int material = materials[j / 3];
+			auto found = meshGroups.find(material);
+			if (found == meshGroups.end())
 			{
-				continue;
+				SubMesh group;
+				group.index_offset = 0;
+				group.index_count = 0;
+				group.material_id = material;
+				group.mesh_id = i;
+				group.influence_count = 4;
+				group.bounds_min = p.vertex;
+				group.bounds_max = p.vertex;
+				found = meshGroups.emplace(material, groups.size()).first;
+				groups.push_back(group);
+				groupIndices.push_back(std::vector<int>());
 			}
 
-			unsigned int numOfClusters = currSkin->GetClusterCount();
-			for (unsigned int clusterIndex = 0; clusterIndex < numOfClusters; ++clusterIndex)
-			{
-				FbxCluster* currCluster = currSkin->GetCluster(clusterIndex);
-				std::string currJointName = currCluster->GetLink()->GetName();
-				int currJointIndex = FindJointIndexUsingName(currJointName, skeleton);
+			SubMesh& group = groups[found->second];
+			group.bounds_min = glm::min(group.bounds_min, p.vertex);
+			group.bounds_max = glm::max(group.bounds_max, p.vertex);
+			groupIndices[found->second].push_back(n + j);
 
-				//Associate each joint with the control points it affects
-				unsigned int numOfIndices = currCluster->GetControlPointIndicesCount();
-				for (unsigned int j = 0; j < numOfIndices; ++j)
-				{
-					BlendingWeight currBlending;
-					currBlending.index = currJointIndex;
-					currBlending.weight = currCluster->GetControlPointWeights()[j];
+			mesh.push_back(p);
+		}
+	}
 
-					int controlpointindex = currCluster->GetControlPointIndices()[j];
+	// Lay out the index buffer by material so draws of one material are next to each other, meshes keep their order
+	std::vector<size_t> order(groups.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return groups[a].material_id < groups[b].material_id; });
 
-					WeightMap.insert(std::make_pair(controlpointindex, currBlending));
-				}
-			}
+	submeshes.clear();
+	for (size_t i : order)
+	{
+		SubMesh submesh = groups[i];
+		submesh.index_offset = (int)index.size();
+		submesh.index_count = (int)groupIndices[i].size();
+		index.insert(index.end(), groupIndices[i].begin(), groupIndices[i].end());
+		submeshes.push_back(submesh);
+	}
+
+	// Share identical corners so the index buffer actually indexes something
+	MeshOptimizer::WeldVertices(mesh, index);
+
+	return 0;
+}
+
+bool Importer::ImportMaterialData(std::vector<MaterialData>& materials)
+{
+	materials.resize(lScene->GetMaterialCount());
+	for (int i = 0; i < lScene->GetMaterialCount(); ++i)
+	{
+		FbxSurfaceMaterial* pMaterial = lScene->GetMaterial(i);
+		MaterialData& material = materials[i];
+		material.ambient = glm::vec3(0.0f);
+		material.diffuse = glm::vec3(1.0f);
+		material.emissive = glm::vec3(0.0f);
+		material.specular = glm::vec3(0.0f);
+		material.shininess = 0.0f;
+
+		// Phong derives from Lambert, anything else keeps the defaults
+		if (pMaterial->GetClassId().Is(FbxSurfaceLambert::ClassId))
+		{
+			FbxSurfaceLambert* pLambert = static_cast<FbxSurfaceLambert*>(pMaterial);
+			FbxDouble3 ambient = pLambert->Ambient.Get();
+			FbxDouble3 diffuse = pLambert->Diffuse.Get();
+			FbxDouble3 emissive = pLambert->Emissive.Get();
+			float ambientFactor = (float)pLambert->AmbientFactor.Get();
+			float diffuseFactor = (float)pLambert->DiffuseFactor.Get();
+			float emissiveFactor = (float)pLambert->EmissiveFactor.Get();
+			material.ambient = glm::vec3((float)ambient[0], (float)ambient[1], (float)ambient[2]) * ambientFactor;
+			material.diffuse = glm::vec3((float)diffuse[0], (float)diffuse[1], (float)diffuse[2]) * diffuseFactor;
+			material.emissive = glm::vec3((float)emissive[0], (float)emissive[1], (float)emissive[2]) * emissiveFactor;
+		}
+		if (pMaterial->GetClassId().Is(FbxSurfacePhong::ClassId))
+		{
+			FbxSurfacePhong* pPhong = static_cast<FbxSurfacePhong*>(pMaterial);
+			FbxDouble3 specular = pPhong->Specular.Get();
+			float specularFactor = (float)pPhong->SpecularFactor.Get();
+			material.specular = glm::vec3((float)specular[0], (float)specular[1], (float)specular[2]) * specularFactor;
+			material.shininess = (float)pPhong->Shininess.Get();
 		}
+	}
+
+	return true;
+}
+
+void Importer::ImportTriangleMaterials(FbxMesh* pMesh, const std::vector<int>& polygons, const std::unordered_map<FbxSurfaceMaterial*, int>& materialIds, std::vector<int>& materials)
+{
+	materials.assign(polygons.size(), -1);
 
-		// Current index count
-		int n = 0 + (int)index.size();
+	FbxGeometryElementMaterial* pElement = pMesh->GetElementMaterial(0);
+	FbxNode* pNode = pMesh->GetNode();
+	if (!pElement || !pNode)
+	{
+		return;
+	}
 
-		// The reason we can assume each polygon has 3 vertices is because we called triangulate function before
-		int polygonIndexCount = pMesh->GetPolygonCount();
-		for (int j = 0; j < polygonIndexCount; j++)
+	// Material indices point into the node's material list
+	FbxLayerElementArrayReadLock<int> indexLock(pElement->GetIndexArray());
+	const int* indices = indexLock.GetData();
+	int indexCount = pElement->GetIndexArray().GetCount();
+	bool allSame = pElement->GetMappingMode() == FbxLayerElement::eAllSame;
+	if (!indices || (!allSame && pElement->GetMappingMode() != FbxLayerElement::eByPolygon))
+	{
+		return;
+	}
+
+	for (size_t t = 0; t < polygons.size(); ++t)
+	{
+		int element = allSame ? 0 : polygons[t];
+		if (element >= indexCount)
 		{
-			index.push_back(n + 3 * j + 0);
-			index.push_back(n + 3 * j + 1);
-			index.push_back(n + 3 * j + 2);
+			continue;
+		}
 
-			MeshData p1, p2, p3;
+		FbxSurfaceMaterial* pMaterial = pNode->GetMaterial(indices[element]);
+		auto found = materialIds.find(pMaterial);
+		if (found != materialIds.end())
+		{
+			materials[t] = found->second;
+		}
+	}
+}
 
-			p1.vertex.x = (float)vertex_array[index_array[3 * j + 0]].mData[0];
-			p1.vertex.y = (float)vertex_array[index_array[3 * j + 0]].mData[1];
-			p1.vertex.z = (float)vertex_array[index_array[3 * j + 0]].mData[2];
+void Importer::TriangulateMesh(FbxMesh* pMesh, std::vector<int>& corners, std::vector<int>& polygons)
+{
+	int polygonCount = pMesh->GetPolygonCount();
+	int cornerCount = pMesh->GetPolygonVertexCount();
 
-			p2.vertex.x = (float)vertex_array[index_array[3 * j + 1]].mData[0];
-			p2.vertex.y = (float)vertex_array[index_array[3 * j + 1]].mData[1];
-			p2.vertex.z = (float)vertex_array[index_array[3 * j + 1]].mData[2];
+	// Every polygon has at least three corners, so this only holds when all of them are triangles
+	if (cornerCount == 3 * polygonCount)
+	{
+		corners.resize(cornerCount);
+		for (int i = 0; i < cornerCount; ++i)
+		{
+			corners[i] = i;
+		}
+		polygons.resize(polygonCount);
+		for (int i = 0; i < polygonCount; ++i)
+		{
+			polygons[i] = i;
+		}
+		return;
+	}
 
-			p3.vertex.x = (float)vertex_array[index_array[3 * j + 2]].mData[0];
-			p3.vertex.y = (float)vertex_array[index_array[3 * j + 2]].mData[1];
-			p3.vertex.z = (float)vertex_array[index_array[3 * j + 2]].mData[2];
+	FbxVector4* vertex_array = pMesh->GetControlPoints();
+	const int* index_array = pMesh->GetPolygonVertices();
 
-			p1.normal.x = (float)normal_array[3 * j + 0].mData[0];
-			p1.normal.y = (float)normal_array[3 * j + 0].mData[1];
-			p1.normal.z = (float)normal_array[3 * j + 0].mData[2];
+	std::vector<glm::vec3> points;
+	std::vector<int> local;
+	corners.clear();
+	corners.reserve(cornerCount * 2);
+	polygons.clear();
+	for (int polygon = 0; polygon < polygonCount; ++polygon)
+	{
+		int first = pMesh->GetPolygonVertexIndex(polygon);
+		int size = pMesh->GetPolygonSize(polygon);
 
-			p2.normal.x = (float)normal_array[3 * j + 1].mData[0];
-			p2.normal.y = (float)normal_array[3 * j + 1].mData[1];
-			p2.normal.z = (float)normal_array[3 * j + 1].mData[2];
+		points.resize(size);
+		for (int k = 0; k < size; ++k)
+		{
+			const FbxVector4& position = vertex_array[index_array[first + k]];
+			points[k] = glm::vec3((float)position.mData[0], (float)position.mData[1], (float)position.mData[2]);
+		}
 
-			p3.normal.x = (float)normal_array[3 * j + 2].mData[0];
-			p3.normal.y = (float)normal_array[3 * j + 2].mData[1];
-			p3.normal.z = (float)normal_array[3 * j + 2].mData[2];
+		local.clear();
+		Triangulator::TriangulatePolygon(points.data(), size, local);
+		for (int k : local)
+		{
+			corners.push_back(first + k);
+		}
+		polygons.insert(polygons.end(), local.size() / 3, polygon);
+	}
+}
 
-			p1.vertex = model_matrix * glm::vec4(p1.vertex.x, p1.vertex.y, p1.vertex.z, 1.0);
-			p2.vertex = model_matrix * glm::vec4(p2.vertex.x, p2.vertex.y, p2.vertex.z, 1.0);
-			p3.vertex = model_matrix * glm::vec4(p3.vertex.x, p3.vertex.y, p3.vertex.z, 1.0);
+void Importer::ImportSkinWeights(FbxMesh* pMesh, std::vector<glm::ivec4>& skin_index, std::vector<glm::vec4>& skin_weight)
+{
+	ProfileScope scope("Skin weights", filepath);
+
+	int controlPointCount = pMesh->GetControlPointsCount();
+	skin_index.assign(controlPointCount, glm::ivec4(-1, -1, -1, -1));
+	skin_weight.assign(controlPointCount, glm::vec4(0, 0, 0, 0));
+
+	// A deformer is a FBX thing, which contains some clusters
+	// A cluster contains a link, which is basically a joint
+	// Normally, there is only one deformer in a mesh
+	std::vector<FbxCluster*> clusters;
+	std::vector<int> clusterJoints;
+	int numOfSkins = pMesh->GetDeformerCount(FbxDeformer::eSkin);
+	for (int deformerIndex = 0; deformerIndex < numOfSkins; ++deformerIndex)
+	{
+		FbxSkin* currSkin = static_cast<FbxSkin*>(pMesh->GetDeformer(deformerIndex, FbxDeformer::eSkin));
+		for (int clusterIndex = 0; clusterIndex < currSkin->GetClusterCount(); ++clusterIndex)
+		{
+			FbxCluster* currCluster = currSkin->GetCluster(clusterIndex);
+			int currJointIndex = currCluster->GetLink() ? FindJointIndexUsingNode(currCluster->GetLink()) : -1;
+			if (currJointIndex < 0)
+			{
+				continue;
+			}
+			clusters.push_back(currCluster);
+			clusterJoints.push_back(currJointIndex);
+		}
+	}
 
-			p1.normal = model_inverse_transpose_matrix * glm::vec4(p1.normal.x, p1.normal.y, p1.normal.z, 1.0);
-			p2.normal = model_inverse_transpose_matrix * glm::vec4(p2.normal.x, p2.normal.y, p2.normal.z, 1.0);
-			p3.normal = model_inverse_transpose_matrix * glm::vec4(p3.normal.x, p3.normal.y, p3.normal.z, 1.0);
+	// First pass counts influences per control point, the prefix sum turns the counts into row offsets
+	std::vector<int> offsets(controlPointCount + 1, 0);
+	for (FbxCluster* currCluster : clusters)
+	{
+		int numOfIndices = currCluster->GetControlPointIndicesCount();
+		const int* controlPointIndices = currCluster->GetControlPointIndices();
+		for (int j = 0; j < numOfIndices; ++j)
+		{
+			if (controlPointIndices[j] >= 0 && controlPointIndices[j] < controlPointCount)
+			{
+				offsets[controlPointIndices[j] + 1]++;
+			}
+		}
+	}
+	for (int i = 0; i < controlPointCount; ++i)
+	{
+		offsets[i + 1] += offsets[i];
+	}
 
-			// Get the first UV sets
-			if (uvsetName.GetCount() > 0)
+	// Second pass scatters the weights into their rows
+	std::vector<BlendingWeight> weights(offsets[controlPointCount]);
+	std::vector<int> cursor(offsets.begin(), offsets.end() - 1);
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		int numOfIndices = clusters[c]->GetControlPointIndicesCount();
+		const int* controlPointIndices = clusters[c]->GetControlPointIndices();
+		const double* controlPointWeights = clusters[c]->GetControlPointWeights();
+		for (int j = 0; j < numOfIndices; ++j)
+		{
+			if (controlPointIndices[j] >= 0 && controlPointIndices[j] < controlPointCount)
 			{
-				FbxVector2 uv1, uv2, uv3;
-				bool flag1, flag2, flag3;
+				BlendingWeight& currBlending = weights[cursor[controlPointIndices[j]]++];
+				currBlending.index = clusterJoints[c];
+				currBlending.weight = (float)controlPointWeights[j];
+			}
+		}
+	}
 
-				pMesh->GetPolygonVertexUV(j, 0, uvsetName.GetStringAt(0), uv1, flag1);
-				pMesh->GetPolygonVertexUV(j, 1, uvsetName.GetStringAt(0), uv2, flag2);
-				pMesh->GetPolygonVertexUV(j, 2, uvsetName.GetStringAt(0), uv3, flag3);
+	// Keep the four largest influences, ties are broken by joint index so the result does not depend on cluster order
+	for (int i = 0; i < controlPointCount; ++i)
+	{
+		BlendingWeight* begin = weights.data() + offsets[i];
+		BlendingWeight* end = weights.data() + offsets[i + 1];
+		BlendingWeight* last = begin + std::min<ptrdiff_t>(4, end - begin);
+		std::partial_sort(begin, last, end, [](const BlendingWeight& a, const BlendingWeight& b)
+		{
+			return a.weight != b.weight ? a.weight > b.weight : a.index < b.index;
+		});
 
-				p1.uv.x = (float)uv1.mData[0];
-				p1.uv.y = (float)uv1.mData[1];
+		float sum = 0;
+		for (BlendingWeight* w = begin; w != last; ++w)
+		{
+			sum += w->weight;
+		}
+		if (sum <= 0)
+		{
+			continue;
+		}
+
+		for (int k = 0; k < last - begin; ++k)
+		{
+			skin_index[i][k] = begin[k].index;
+			skin_weight[i][k] = begin[k].weight / sum;
+		}
+	}
+}
+
+bool Importer::ImportSkeletonMeshData(Skeleton& skeleton)
+{
+	ProfileScope scope("Skeleton walk", filepath);
 
-				p2.uv.x = (float)uv2.mData[0];
-				p2.uv.y = (float)uv2.mData[1];
+	JointNameMap.clear();
+	JointNodeMap.clear();
 
-				p2.uv.x = (float)uv3.mData[0];
-				p2.uv.y = (float)uv3.mData[1];
-			}
+	for (int childIndex = 0; childIndex < lRootNode->GetChildCount(); ++childIndex)
+	{
+		FbxNode* currNode = lRootNode->GetChild(childIndex);
+		ProcessSkeletonHierarchyRecursively(currNode, 0, 0, -1, skeleton);
+	}
+
+	return true;
+}
 
-			// Get skin info from WidhtMap
-			typedef std::multimap<int, BlendingWeight>::iterator iter;
-			int this_index = index_array[3 * j + 0];
-			for (std::pair<iter, iter> range(WeightMap.equal_range(this_index)); range.first != range.second; ++range.first)
+bool Importer::ImportAnimationData(AnimationClip& clip, AnimationImportMode mode)
+{
+	// Get animation information
+	// Only the first take, ImportAnimationClips reads all of them
+	FbxAnimStack* currAnimStack = lScene->GetSrcObject<FbxAnimStack>(0);
+	if (currAnimStack)
+	{
+		AnimationTake take;
+		PrepareAnimationTake(currAnimStack, take);
+		SampleAnimationTake(take, clip, mode);
+	}	
+	return true;
+}
+
+bool Importer::ImportAnimationClips(std::vector<AnimationClip>& clips, AnimationImportMode mode)
+{
+	// Curves are looked up on this thread, after that the takes only read them and can be sampled side by side
+	int stackCount = lScene->GetSrcObjectCount<FbxAnimStack>();
+	std::vector<AnimationTake> takes(stackCount);
+	for (int i = 0; i < stackCount; ++i)
+	{
+		PrepareAnimationTake(lScene->GetSrcObject<FbxAnimStack>(i), takes[i]);
+	}
+
+	clips.resize(stackCount);
+	ThreadPool::Get().ParallelFor(0, stackCount, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			SampleAnimationTake(takes[i], clips[i], mode);
+		}
+	}, stackCount);
+
+	return true;
+}
+
+bool Importer::RemapToSkeleton(AnimationClip& clip, const Skeleton& skeleton)
+{
+	const size_t jointCount = skeleton.joints.size();
+
+	std::unordered_map<std::string, int> clipJoints;
+	for (size_t i = 0; i < clip.joint_names.size(); ++i)
+	{
+		clipJoints.emplace(clip.joint_names[i], (int)i);
+	}
+
+	// Clip joint of every skeleton joint, -1 when the clip does not animate it
+	std::vector<int> source(jointCount, -1);
+	std::vector<bool> sameParent(jointCount, false);
+	std::vector<bool> used(clip.joint_names.size(), false);
+	size_t matched = 0;
+	for (size_t j = 0; j < jointCount; ++j)
+	{
+		auto found = clipJoints.find(skeleton.joints[j].name);
+		if (found == clipJoints.end())
+		{
+			continue;
+		}
+		source[j] = found->second;
+		used[found->second] = true;
+		matched++;
+	}
+	if (matched == 0)
+	{
+		printf("%s has no joint of the skeleton\n", clip.name.c_str());
+		return false;
+	}
+
+	// Where the parents agree the local transform can be copied, elsewhere it is rebuilt from the globals
+	std::vector<glm::mat4> bindLocals(jointCount);
+	for (size_t j = 0; j < jointCount; ++j)
+	{
+		int parent = skeleton.joints[j].parent_index;
+		bindLocals[j] = glm::inverse(skeleton.joints[j].inversed);
+		if (parent >= 0)
+		{
+			bindLocals[j] = skeleton.joints[parent].inversed * bindLocals[j];
+		}
+
+		if (source[j] >= 0)
+		{
+			int clipParent = clip.poses.parent_index[source[j]];
+			sameParent[j] = parent < 0 ? clipParent < 0 : clipParent >= 0 && source[parent] == clipParent;
+		}
+	}
+
+	// Frames only read their own poses, clip globals come from the clip's own hierarchy
+	const ClipPoses& clipPoses = clip.poses;
+	ClipPoses poses;
+	poses.Resize(clipPoses.frame_count, (int)jointCount);
+	for (size_t j = 0; j < jointCount; ++j)
+	{
+		poses.parent_index[j] = skeleton.joints[j].parent_index;
+	}
+
+	ThreadPool::Get().ParallelFor(0, clipPoses.frame_count, [&](int begin, int end)
+	{
+		std::vector<glm::mat4> clipGlobals(clipPoses.joint_count);
+		std::vector<glm::mat4> globals(jointCount);
+		for (int i = begin; i < end; ++i)
+		{
+			for (int j = 0; j < clipPoses.joint_count; ++j)
 			{
-				if (p1.index.x == -1)
-				{
-					p1.index.x = range.first->second.index;
-					p1.weight.x = range.first->second.weight;
-				}
-				else if (p1.index.y == -1)
-				{
-					p1.index.y = range.first->second.index;
-					p1.weight.y = range.first->second.weight;
-				}
-				else if (p1.index.z == -1)
-				{
-					p1.index.z = range.first->second.index;
-					p1.weight.z = range.first->second.weight;
-				}
-				else
-				{
-					p1.index.w = range.first->second.index;
-					p1.weight.w = range.first->second.weight;
-				}
+				size_t pose = clipPoses.Index(i, j);
+				glm::mat4 local = ClipSampler::ComposePose(clipPoses.rotations[pose], clipPoses.translations[pose], clipPoses.scales[pose]);
+				int parent = clipPoses.parent_index[j];
+				clipGlobals[j] = parent >= 0 ? clipGlobals[parent] * local : local;
 			}
 
-			this_index = index_array[3 * j + 1];
-			for (std::pair<iter, iter> range(WeightMap.equal_range(this_index)); range.first != range.second; ++range.first)
+			for (size_t j = 0; j < jointCount; ++j)
 			{
-				if (p2.index.x == -1)
-				{
-					p2.index.x = range.first->second.index;
-					p2.weight.x = range.first->second.weight;
-				}
-				else if (p2.index.y == -1)
+				int parent = skeleton.joints[j].parent_index;
+				glm::mat4 parentGlobal = parent >= 0 ? globals[parent] : glm::mat4(1.0f);
+				size_t pose = poses.Index(i, (int)j);
+
+				if (source[j] < 0)
 				{
-					p2.index.y = range.first->second.index;
-					p2.weight.y = range.first->second.weight;
+					globals[j] = parentGlobal * bindLocals[j];
+					ClipSampler::DecomposePose(bindLocals[j], poses.rotations[pose], poses.translations[pose], poses.scales[pose]);
 				}
-				else if (p2.index.z == -1)
+				else if (sameParent[j])
 				{
-					p2.index.z = range.first->second.index;
-					p2.weight.z = range.first->second.weight;
+					size_t clipPose = clipPoses.Index(i, source[j]);
+					globals[j] = clipGlobals[source[j]];
+					poses.rotations[pose] = clipPoses.rotations[clipPose];
+					poses.translations[pose] = clipPoses.translations[clipPose];
+					poses.scales[pose] = clipPoses.scales[clipPose];
 				}
 				else
 				{
-					p2.index.w = range.first->second.index;
-					p2.weight.w = range.first->second.weight;
+					globals[j] = clipGlobals[source[j]];
+					ClipSampler::DecomposePose(glm::inverse(parentGlobal) * globals[j], poses.rotations[pose], poses.translations[pose], poses.scales[pose]);
 				}
 			}
+		}
+	});
+	clip.poses = std::move(poses);
 
-			this_index = index_array[3 * j + 2];
-			for (std::pair<iter, iter> range(WeightMap.equal_range(this_index)); range.first != range.second; ++range.first)
+	// Keys stay relative to the clip's parent, a track whose parent differs is only reordered
+	if (!clip.tracks.empty())
+	{
+		std::vector<AnimationTrack> tracks(jointCount);
+		size_t reparented = 0;
+		for (size_t j = 0; j < jointCount; ++j)
+		{
+			AnimationTrack& track = tracks[j];
+			if (source[j] >= 0)
 			{
-				if (p3.index.x == -1)
-				{
-					p3.index.x = range.first->second.index;
-					p3.weight.x = range.first->second.weight;
-				}
-				else if (p3.index.y == -1)
-				{
-					p3.index.y = range.first->second.index;
-					p3.weight.y = range.first->second.weight;
-				}
-				else if (p3.index.z == -1)
-				{
-					p3.index.z = range.first->second.index;
-					p3.weight.z = range.first->second.weight;
-				}
-				else
+				int clipParent = clip.tracks[source[j]].parent_index;
+				int parent = skeleton.joints[j].parent_index;
+				if (parent < 0 ? clipParent >= 0 : clipParent < 0 || source[parent] != clipParent)
 				{
-					p3.index.w = range.first->second.index;
-					p3.weight.w = range.first->second.weight;
+					reparented++;
 				}
+				track = std::move(clip.tracks[source[j]]);
 			}
+			else
+			{
+				glm::quat rotation;
+				glm::vec3 translation;
+				float scale;
+				ClipSampler::DecomposePose(bindLocals[j], rotation, translation, scale);
+				track.translation_times.assign(1, 0.0f);
+				track.translations.assign(1, translation);
+				track.rotation_times.assign(1, 0.0f);
+				track.rotations.assign(1, rotation);
+				track.scale_times.assign(1, 0.0f);
+				track.scales.assign(1, glm::vec3(scale));
+			}
+			track.name = skeleton.joints[j].name;
+			track.parent_index = skeleton.joints[j].parent_index;
+		}
+		clip.tracks.swap(tracks);
 
-			mesh.push_back(p1);
-			mesh.push_back(p2);
-			mesh.push_back(p3);
+		if (reparented)
+		{
+			printf("%s: %zu tracks are keyed relative to a joint the skeleton does not use as their parent\n", clip.name.c_str(), reparented);
 		}
+	}
 
-		WeightMap.clear();
+	clip.joint_names.resize(jointCount);
+	for (size_t j = 0; j < jointCount; ++j)
+	{
+		clip.joint_names[j] = skeleton.joints[j].name;
 	}
 
-	return 0;
+	printf("%s: %zu of %zu skeleton joints animated, %zu clip joints unused\n", clip.name.c_str(), matched, jointCount, (size_t)std::count(used.begin(), used.end(), false));
+	return true;
 }
 
-bool Importer::ImportSkeletonMeshData(Skeleton& skeleton)
+void Importer::PrepareAnimationTake(FbxAnimStack* stack, AnimationTake& take)
 {
+	ProfileScope scope("Clip sampling", filepath);
+
+	take.name = stack->GetName();
+
+	FbxTakeInfo* takeInfo = lScene->GetTakeInfo(stack->GetName());
+	FbxTimeSpan span = takeInfo ? takeInfo->mLocalTimeSpan : stack->GetLocalTimeSpan();
+	take.start = span.GetStart();
+	take.end = span.GetStop();
+
+	take.nodes.clear();
+	take.jointcount = 0;
+
+	// Blending between layers is not supported, the base layer is used
+	FbxAnimLayer* layer = stack->GetMember<FbxAnimLayer>(0);
 	for (int childIndex = 0; childIndex < lRootNode->GetChildCount(); ++childIndex)
 	{
-		FbxNode* currNode = lRootNode->GetChild(childIndex);
-		ProcessSkeletonHierarchyRecursively(currNode, 0, 0, -1, skeleton);
+		ExtractNodeCurvesRecursively(lRootNode->GetChild(childIndex), -1, 0, -1, layer, take);
 	}
+}
 
-	return true;
+void Importer::ExtractNodeCurvesRecursively(FbxNode* inNode, int inNodeParent, int myIndex, int inParentIndex, FbxAnimLayer* layer, AnimationTake& take)
+{
+	NodeCurves curves;
+	curves.parent = inNodeParent;
+	curves.is_joint = inNode->GetNodeAttribute() && inNode->GetNodeAttribute()->GetAttributeType() == FbxNodeAttribute::eSkeleton;
+	curves.joint_parent = inParentIndex;
+	curves.name = inNode->GetName();
+
+	FbxPropertyT<FbxDouble3>* properties[3] = { &inNode->LclTranslation, &inNode->LclRotation, &inNode->LclScaling };
+	const char* components[3] = { FBXSDK_CURVENODE_COMPONENT_X, FBXSDK_CURVENODE_COMPONENT_Y, FBXSDK_CURVENODE_COMPONENT_Z };
+	for (int channel = 0; channel < 3; ++channel)
+	{
+		const FbxDouble3 value = properties[channel]->Get();
+		for (int component = 0; component < 3; ++component)
+		{
+			curves.values[channel][component] = value[component];
+			curves.curves[channel][component] = layer ? properties[channel]->GetCurve(layer, components[component]) : nullptr;
+		}
+	}
+
+	// Local = T * Roff * Rp * Rpre * R * Rpost^-1 * Rp^-1 * Soff * Sp * S * Sp^-1
+	// Pre/post rotation and the rotation order only count while the rotation is active
+	FbxAMatrix rotationOffset, rotationPivot, preRotation, postRotation, scalingOffset, scalingPivot;
+	rotationOffset.SetT(inNode->GetRotationOffset(FbxNode::eSourcePivot));
+	rotationPivot.SetT(inNode->GetRotationPivot(FbxNode::eSourcePivot));
+	scalingOffset.SetT(inNode->GetScalingOffset(FbxNode::eSourcePivot));
+	scalingPivot.SetT(inNode->GetScalingPivot(FbxNode::eSourcePivot));
+
+	curves.order = FbxEuler::eOrderXYZ;
+	if (inNode->GetRotationActive())
+	{
+		preRotation.SetR(inNode->GetPreRotation(FbxNode::eSourcePivot));
+		postRotation.SetR(inNode->GetPostRotation(FbxNode::eSourcePivot));
+
+		EFbxRotationOrder order;
+		inNode->GetRotationOrder(FbxNode::eSourcePivot, order);
+		if (order <= eEulerZYX)
+		{
+			curves.order = static_cast<FbxEuler::EOrder>(order);
+		}
+	}
+
+	curves.pre_rotation = rotationOffset * rotationPivot * preRotation;
+	curves.post_rotation = postRotation.Inverse() * rotationPivot.Inverse() * scalingOffset * scalingPivot;
+	curves.post_scaling = scalingPivot.Inverse();
+
+	int nodeIndex = (int)take.nodes.size();
+	take.nodes.push_back(curves);
+	if (curves.is_joint)
+	{
+		take.jointcount++;
+	}
+
+	// Joint parents follow the same rule as ProcessSkeletonHierarchyRecursively so poses line up with the skeleton
+	for (int i = 0; i < inNode->GetChildCount(); i++)
+	{
+		ExtractNodeCurvesRecursively(inNode->GetChild(i), nodeIndex, take.jointcount, curves.is_joint ? myIndex : inParentIndex, layer, take);
+	}
 }
 
-bool Importer::ImportAnimationData(AnimationClip& clip)
+FbxAMatrix Importer::EvaluateLocalTransform(const NodeCurves& node, const FbxTime& time)
 {
-	// Get animation information
-	// Now only supports one take
-	FbxAnimStack* currAnimStack = lScene->GetSrcObject<FbxAnimStack>(0);
-	if (currAnimStack)
+	FbxVector4 channels[3];
+	for (int channel = 0; channel < 3; ++channel)
 	{
-		FbxString animStackName = currAnimStack->GetName();
-		auto mAnimationName = animStackName.Buffer();
-		FbxTakeInfo* takeInfo = lScene->GetTakeInfo(animStackName);
-		FbxTime start = takeInfo->mLocalTimeSpan.GetStart();
-		FbxTime end = takeInfo->mLocalTimeSpan.GetStop();
-		FbxLongLong mAnimationLength = end.GetFrameCount(FbxTime::eFrames24) - start.GetFrameCount(FbxTime::eFrames24) + 1;
+		for (int component = 0; component < 3; ++component)
+		{
+			// Every call keeps its own search index, the one inside the curve would be shared between threads
+			int last = 0;
+			FbxAnimCurve* curve = node.curves[channel][component];
+			channels[channel][component] = curve ? curve->Evaluate(FbxTime(time.Get()), &last) : node.values[channel][component];
+		}
+	}
 
-		clip.frame_count = (int)mAnimationLength;
+	FbxAMatrix translation, rotation, scaling;
+	translation.SetT(channels[0]);
+	FbxRotationOrder(node.order).V2M(rotation, channels[1]);
+	scaling.SetS(channels[2]);
 
+	return translation * node.pre_rotation * rotation * node.post_rotation * scaling * node.post_scaling;
+}
+
+void Importer::SampleAnimationTake(const AnimationTake& take, AnimationClip& clip, AnimationImportMode mode)
+{
+	FbxLongLong first = take.start.GetFrameCount(FbxTime::eFrames24);
+	FbxLongLong mAnimationLength = take.end.GetFrameCount(FbxTime::eFrames24) - first + 1;
 
-		for (FbxLongLong i = start.GetFrameCount(FbxTime::eFrames24); i <= end.GetFrameCount(FbxTime::eFrames24); ++i)
+	clip.name = take.name;
+	clip.joint_names.clear();
+	for (const NodeCurves& node : take.nodes)
+	{
+		if (node.is_joint)
 		{
-			AnimationSample sample;
+			clip.joint_names.push_back(node.name);
+		}
+	}
+	clip.frame_count = (int)mAnimationLength;
+	clip.frame_per_second = 24.0f;
+	clip.duration = (float)(take.end - take.start).GetSecondDouble();
+	clip.is_looping = true;
+
+	// Curve keys leave the poses with the joint hierarchy only, no frames
+	const bool curveKeys = mode == AnimationImportMode::CurveKeys;
+	clip.poses.Resize(curveKeys ? 0 : clip.frame_count, (int)clip.joint_names.size());
+	int joint = 0;
+	for (const NodeCurves& node : take.nodes)
+	{
+		if (node.is_joint)
+		{
+			clip.poses.parent_index[joint++] = node.joint_parent;
+		}
+	}
+	if (curveKeys)
+	{
+		ProfileScope scope("Clip sampling", filepath);
+		ImportAnimationTracks(take, clip);
+		return;
+	}
 
+	// Frames are split across the thread pool, each range keeps its own scratch buffers of node matrices
+	ThreadPool::Get().ParallelFor(0, clip.frame_count, [&](int begin, int end)
+	{
+		ProfileScope scope("Clip sampling", filepath);
+		std::vector<FbxAMatrix> relatives;
+		for (int i = begin; i < end; ++i)
+		{
 			FbxTime currTime;
-			currTime.SetFrame(i, FbxTime::eFrames24);
-			ImportAnimationSample(sample, currTime);
-			clip.samples.push_back(sample);
+			currTime.SetFrame(first + i, FbxTime::eFrames24);
+			ImportAnimationSample(take, currTime, relatives, clip.poses, i);
 		}
-	}	
-	return true;
+	});
 }
 
-bool Importer::ImportAnimationSample(AnimationSample& sample, FbxTime time)
+void Importer::ImportAnimationSample(const AnimationTake& take, const FbxTime& time, std::vector<FbxAMatrix>& relatives, ClipPoses& poses, int frame)
 {
-	for (int childIndex = 0; childIndex < Importer::lRootNode->GetChildCount(); ++childIndex)
+	// Nodes are stored parents first, so transforms relative to the parent joint are composed in one pass
+	relatives.resize(take.nodes.size());
+
+	size_t pose = poses.Index(frame, 0);
+	for (size_t i = 0; i < take.nodes.size(); ++i)
 	{
-		FbxNode* currNode = Importer::lRootNode->GetChild(childIndex);
-		ProcessAnimationSampleRecursively(currNode, 0, 0, -1, sample, time);
+		const NodeCurves& node = take.nodes[i];
+		FbxAMatrix local = EvaluateLocalTransform(node, time);
+		if (node.parent < 0)
+		{
+			relatives[i] = local;
+		}
+		else
+		{
+			// Nodes between two joints are folded into the child joint
+			relatives[i] = take.nodes[node.parent].is_joint ? local : relatives[node.parent] * local;
+		}
+
+		if (!node.is_joint)
+		{
+			continue;
+		}
+
+		// TRS is local to the parent joint, a root joint's is its global transform
+		FbxVector4 t = relatives[i].GetT();
+		FbxQuaternion q = relatives[i].GetQ();
+		FbxVector4 s = relatives[i].GetS();
+		poses.translations[pose] = glm::vec3((float)t[0], (float)t[1], (float)t[2]);
+		poses.rotations[pose] = glm::quat((float)q[3], (float)q[0], (float)q[1], (float)q[2]);
+		poses.scales[pose] = (float)s[0];
+		pose++;
 	}
+}
 
-	return true;
+FbxAMatrix Importer::EvaluateJointLocalTransform(const AnimationTake& take, size_t nodeIndex, const FbxTime& time)
+{
+	// Walk up to the parent joint, the nodes in between are part of the joint's local transform
+	FbxAMatrix local = EvaluateLocalTransform(take.nodes[nodeIndex], time);
+	for (int parent = take.nodes[nodeIndex].parent; parent >= 0 && !take.nodes[parent].is_joint; parent = take.nodes[parent].parent)
+	{
+		local = EvaluateLocalTransform(take.nodes[parent], time) * local;
+	}
+	return local;
+}
+
+void Importer::ImportAnimationTracks(const AnimationTake& take, AnimationClip& clip)
+{
+	std::vector<FbxLongLong> times;
+	size_t keycount = 0;
+
+	clip.tracks.clear();
+	clip.tracks.reserve(take.jointcount);
+	for (size_t nodeIndex = 0; nodeIndex < take.nodes.size(); ++nodeIndex)
+	{
+		const NodeCurves& node = take.nodes[nodeIndex];
+		if (!node.is_joint)
+		{
+			continue;
+		}
+
+		clip.tracks.push_back(AnimationTrack());
+		AnimationTrack& track = clip.tracks.back();
+		track.name = node.name;
+		track.parent_index = node.joint_parent;
+
+		// Values are evaluated with pivots, pre/post rotation and rotation order applied, only the times come from the curves.
+		// Animated nodes between two joints are not keyed, their curves do not add key times.
+		CollectKeyTimes(node.curves[0], take.start, take.end, times);
+		for (FbxLongLong key : times)
+		{
+			FbxTime time;
+			time.Set(key);
+			FbxVector4 t = EvaluateJointLocalTransform(take, nodeIndex, time).GetT();
+			track.translation_times.push_back((float)(time.GetSecondDouble() - take.start.GetSecondDouble()));
+			track.translations.push_back(glm::vec3((float)t[0], (float)t[1], (float)t[2]));
+		}
+
+		CollectKeyTimes(node.curves[1], take.start, take.end, times);
+		for (FbxLongLong key : times)
+		{
+			FbxTime time;
+			time.Set(key);
+			FbxQuaternion q = EvaluateJointLocalTransform(take, nodeIndex, time).GetQ();
+			track.rotation_times.push_back((float)(time.GetSecondDouble() - take.start.GetSecondDouble()));
+			track.rotations.push_back(glm::quat((float)q[3], (float)q[0], (float)q[1], (float)q[2]));
+		}
+
+		CollectKeyTimes(node.curves[2], take.start, take.end, times);
+		for (FbxLongLong key : times)
+		{
+			FbxTime time;
+			time.Set(key);
+			FbxVector4 s = EvaluateJointLocalTransform(take, nodeIndex, time).GetS();
+			track.scale_times.push_back((float)(time.GetSecondDouble() - take.start.GetSecondDouble()));
+			track.scales.push_back(glm::vec3((float)s[0], (float)s[1], (float)s[2]));
+		}
+
+		keycount += track.translations.size() + track.rotations.size() + track.scales.size();
+	}
+
+	printf("%s: read %zu keys instead of %zu resampled channel values\n", take.name.c_str(), keycount, clip.tracks.size() * 3 * clip.frame_count);
+}
+
+void Importer::CollectKeyTimes(FbxAnimCurve* const curves[3], const FbxTime& start, const FbxTime& end, std::vector<FbxLongLong>& times)
+{
+	times.clear();
+	times.push_back(start.Get());
+
+	// A channel without curves does not move and needs only one key, otherwise the span ends are always keyed
+	if (!curves[0] && !curves[1] && !curves[2])
+	{
+		return;
+	}
+	times.push_back(end.Get());
+
+	for (int component = 0; component < 3; ++component)
+	{
+		FbxAnimCurve* curve = curves[component];
+		if (!curve)
+		{
+			continue;
+		}
+
+		for (int keyIndex = 0; keyIndex < curve->KeyGetCount(); ++keyIndex)
+		{
+			FbxLongLong time = curve->KeyGetTime(keyIndex).Get();
+			if (time > start.Get() && time < end.Get())
+			{
+				times.push_back(time);
+			}
+		}
+	}
+
+	std::sort(times.begin(), times.end());
+	times.erase(std::unique(times.begin(), times.end()), times.end());
 }
 
 //////////////////////////////////////////////////////////////////////////////////////
@@ -362,9 +1150,6 @@ bool Importer::ImportAnimationSample(AnimationSample& sample, FbxTime time)
  * Print a node, its attributes, and all its children recursively.
  */
 
- /* Tab character ("\t") counter */
-int numTabs = 0;
-
 /**
  * Print the required number of tabs.
  */
@@ -463,7 +1248,8 @@ void Importer::PrintNode(FbxNode* pNode)
 
 void Importer::ProcessSkeletonHierarchyRecursively(FbxNode* inNode, int inDepth, int myIndex, int inParentIndex, Skeleton& skeleton)
 {
-	if (inNode->GetNodeAttribute() && inNode->GetNodeAttribute()->GetAttributeType() && inNode->GetNodeAttribute()->GetAttributeType() == FbxNodeAttribute::eSkeleton)
+	bool isJoint = inNode->GetNodeAttribute() && inNode->GetNodeAttribute()->GetAttributeType() == FbxNodeAttribute::eSkeleton;
+	if (isJoint)
 	{
 		Joint currJoint;
 		currJoint.parent_index = inParentIndex;
@@ -488,63 +1274,54 @@ void Importer::ProcessSkeletonHierarchyRecursively(FbxNode* inNode, int inDepth,
 		glm::decompose(transformation, scale, rotation, translation, skew, perspective);
 		currJoint.coord = translation;
 
+		JointNameMap.emplace(currJoint.name, (int)skeleton.joints.size());
+		JointNodeMap.emplace(inNode, (int)skeleton.joints.size());
 		skeleton.joints.push_back(currJoint);
 	}
 	for (int i = 0; i < inNode->GetChildCount(); i++)
 	{
-		ProcessSkeletonHierarchyRecursively(inNode->GetChild(i), inDepth + 1, skeleton.joints.size(), myIndex, skeleton);
+		// The parent is the closest joint above, joints are added before their children so parent_index < index
+		ProcessSkeletonHierarchyRecursively(inNode->GetChild(i), inDepth + 1, skeleton.joints.size(), isJoint ? myIndex : inParentIndex, skeleton);
 	}
 }
 
-void Importer::ProcessAnimationSampleRecursively(FbxNode* inNode, int inDepth, int myIndex, int inParentIndex, AnimationSample & sample, FbxTime time)
+void Importer::BuildJointMap(const Skeleton& skeleton)
 {
-	if (inNode->GetNodeAttribute() && inNode->GetNodeAttribute()->GetAttributeType() && inNode->GetNodeAttribute()->GetAttributeType() == FbxNodeAttribute::eSkeleton)
-	{
-		JointPose currPose;
-		currPose.parent_index = inParentIndex;
-
-		FbxAMatrix global_mat = inNode->EvaluateGlobalTransform(time);
-
-		float elemetns[16] = {
-			global_mat.Get(0, 0), global_mat.Get(0, 1), global_mat.Get(0, 2), global_mat.Get(0, 3),
-			global_mat.Get(1, 0), global_mat.Get(1, 1), global_mat.Get(1, 2), global_mat.Get(1, 3),
-			global_mat.Get(2, 0), global_mat.Get(2, 1), global_mat.Get(2, 2), global_mat.Get(2, 3),
-			global_mat.Get(3, 0), global_mat.Get(3, 1), global_mat.Get(3, 2), global_mat.Get(3, 3),
-		};
-		currPose.global_inverse_matrix = glm::make_mat4(elemetns);
-
-		glm::mat4 transformation = currPose.global_inverse_matrix;
-		glm::vec3 scale;
-		glm::quat rotation;
-		glm::vec3 translation;
-		glm::vec3 skew;
-		glm::vec4 perspective;
-		glm::decompose(transformation, scale, rotation, translation, skew, perspective);
-		
-		currPose.trans = glm::vec4(translation, 1.0);
-		currPose.rot = rotation;
-		currPose.scale = scale.x;
+	JointNameMap.clear();
+	JointNodeMap.clear();
+	JointNameMap.reserve(skeleton.joints.size());
 
-		sample.jointposes.push_back(currPose);
-	}
-	for (int i = 0; i < inNode->GetChildCount(); i++)
+	const int jointCount = static_cast<int>(skeleton.joints.size());
+	for (int i = 0; i < jointCount; i++)
 	{
-		ProcessAnimationSampleRecursively(inNode->GetChild(i), inDepth + 1, sample.jointposes.size(), myIndex, sample, time);
+		JointNameMap.emplace(skeleton.joints[i].name, i);
 	}
 }
 
-int Importer::FindJointIndexUsingName(std::string name, Skeleton skeleton)
+int Importer::FindJointIndexUsingName(const std::string& name)
 {
-	for (int i = 0; i < skeleton.joints.size(); i++)
+	auto found = JointNameMap.find(name);
+	if (found != JointNameMap.end())
 	{
-		if (skeleton.joints[i].name.compare(name) == 0)
-		{
-			return i;
-		}
+		return found->second;
 	}
 	return -1;
 }
 
+int Importer::FindJointIndexUsingNode(FbxNode* node)
+{
+	auto found = JointNodeMap.find(node);
+	if (found != JointNodeMap.end())
+	{
+		return found->second;
+	}
+
+	// Fall back to the name when the skeleton was imported from another scene
+	int index = FindJointIndexUsingName(node->GetName());
+	JointNodeMap.emplace(node, index);
+	return index;
+}
+
 FbxAMatrix Importer::GetGeometryTransformation(FbxNode* inNode)
 {
 	if (!inNode)
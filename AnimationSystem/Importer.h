@@ -3,27 +3,90 @@
 #include <glm/matrix.hpp>
 #include "SceneProxy.h"
 
-#include <map>
+#include <unordered_map>
 
+enum class AnimationImportMode : uint8_t
+{
+	// Evaluate every joint at every 24 fps frame into AnimationClip::poses
+	Resample = 0,
+	// Read the keys of the translation, rotation and scaling curves into AnimationClip::tracks
+	CurveKeys = 1,
+};
+
+enum class ImportScope : uint8_t
+{
+	// Meshes, skeleton and animation
+	Everything = 0,
+	// Skip materials, textures and blend shapes, nothing is triangulated
+	AnimationOnly = 1,
+};
+
+// Curves and static transform data of one node in one take. Extracted up front so that
+// frames and takes can be evaluated on worker threads without the scene evaluator.
+struct NodeCurves
+{
+	std::string      name;
+	int              parent;          // index of the parent node in AnimationTake::nodes, -1 under the scene root
+	bool             is_joint;
+	int              joint_parent;    // parent_index written to ClipPoses
+	FbxAnimCurve*    curves[3][3];    // translation, rotation, scaling by x, y, z, nullptr when not animated
+	double           values[3][3];    // used for the components without a curve
+	FbxEuler::EOrder order;
+	FbxAMatrix       pre_rotation;    // Roff * Rp * Rpre
+	FbxAMatrix       post_rotation;   // Rpost^-1 * Rp^-1 * Soff * Sp
+	FbxAMatrix       post_scaling;    // Sp^-1
+};
+
+struct AnimationTake
+{
+	std::string             name;
+	FbxTime                 start;
+	FbxTime                 end;
+	std::vector<NodeCurves> nodes;    // parents are stored before their children
+	int                     jointcount;
+};
+
+// One import session. Every instance owns its own FbxManager and scene,
+// so different files can be imported on different threads at the same time.
 class Importer
 {
 public:
-	static FbxManager* lSdkManager;
-	static FbxScene* lScene;
-	static FbxNode* lRootNode;
-	static std::multimap<int, BlendingWeight> WeightMap;
+	FbxManager* lSdkManager = nullptr;
+	FbxScene* lScene = nullptr;
+	FbxNode* lRootNode = nullptr;
+
+	// Joint lookup tables, built once while walking the skeleton
+	std::unordered_map<std::string, int> JointNameMap;
+	std::unordered_map<FbxNode*, int> JointNodeMap;
 
 public:
-	bool Init(const char*);
+	Importer() = default;
+	~Importer();
+
+	Importer(const Importer&) = delete;
+	Importer& operator=(const Importer&) = delete;
+
+	// Load a file with a manager of its own
+	bool Init(const char*, ImportScope = ImportScope::Everything);
+	// Load a file into a manager that outlives the importer, see ImportSession
+	bool Init(FbxManager*, const char*, ImportScope = ImportScope::Everything);
+
+	// Manager with IO settings. Creating and destroying managers is serialized, using them is not.
+	static FbxManager* CreateManager();
+	static void DestroyManager(FbxManager*);
 	void PrintData();
 	bool CleanUp();
 
 public:
-	bool ImportMeshData(std::vector<MeshData>&, std::vector<int>&, Skeleton&);
+	bool ImportMeshData(std::vector<MeshData>&, std::vector<int>&, std::vector<SubMesh>&, Skeleton&);
 	bool ImportSkeletonMeshData(Skeleton&);
-	bool ImportMaterialData(MaterialData&);
-	bool ImportAnimationData(AnimationClip&);
-	bool ImportAnimationSample(AnimationSample&, FbxTime);
+	bool ImportMaterialData(std::vector<MaterialData>&);
+	bool ImportAnimationData(AnimationClip&, AnimationImportMode = AnimationImportMode::Resample);
+	bool ImportAnimationClips(std::vector<AnimationClip>&, AnimationImportMode = AnimationImportMode::Resample);
+
+	// Put the poses and tracks of an imported clip in the joint order of the skeleton, matching joints by name.
+	// Joints the clip does not have keep their bind pose. Returns false when no joint matches.
+	static bool RemapToSkeleton(AnimationClip&, const Skeleton&);
 
 private:
 
@@ -36,10 +99,45 @@ private:
 
 	// Recursive function
 	void ProcessSkeletonHierarchyRecursively(FbxNode*, int, int, int, Skeleton&);
-	void ProcessAnimationSampleRecursively(FbxNode*, int, int, int, AnimationSample&, FbxTime);
+	void ExtractNodeCurvesRecursively(FbxNode*, int, int, int, FbxAnimLayer*, AnimationTake&);
+
+	// Animation takes
+	void PrepareAnimationTake(FbxAnimStack*, AnimationTake&);
+	void SampleAnimationTake(const AnimationTake&, AnimationClip&, AnimationImportMode);
+	void ImportAnimationSample(const AnimationTake&, const FbxTime&, std::vector<FbxAMatrix>&, ClipPoses&, int);
+	static FbxAMatrix EvaluateLocalTransform(const NodeCurves&, const FbxTime&);
+	static FbxAMatrix EvaluateJointLocalTransform(const AnimationTake&, size_t, const FbxTime&);
+
+	// Keys of the joint curves, for AnimationImportMode::CurveKeys
+	void ImportAnimationTracks(const AnimationTake&, AnimationClip&);
+	void CollectKeyTimes(FbxAnimCurve* const[3], const FbxTime&, const FbxTime&, std::vector<FbxLongLong>&);
+
+	// Triangle corners as polygon vertex numbers and the polygon of every triangle, polygons with more than three corners go through Triangulator
+	void TriangulateMesh(FbxMesh*, std::vector<int>&, std::vector<int>&);
+
+	// Scene material id of every triangle, -1 when it has none
+	void ImportTriangleMaterials(FbxMesh*, const std::vector<int>&, const std::unordered_map<FbxSurfaceMaterial*, int>&, std::vector<int>&);
+
+	// Skin weights of every control point, four influences at most
+	void ImportSkinWeights(FbxMesh*, std::vector<glm::ivec4>&, std::vector<glm::vec4>&);
+
+	// Import the file into a new scene of lSdkManager
+	bool LoadScene(const char*, ImportScope);
 
 	// Find joint 
-	int FindJointIndexUsingName(std::string, Skeleton);
+	void BuildJointMap(const Skeleton&);
+	int FindJointIndexUsingName(const std::string&);
+	int FindJointIndexUsingNode(FbxNode*);
 	FbxAMatrix GetGeometryTransformation(FbxNode*);
+
+private:
+	// Tab character ("\t") counter for PrintData
+	int numTabs = 0;
+
+	// File of the current scene, names the profiler events
+	std::string filepath;
+
+	// CleanUp destroys the manager only when Init created it, a borrowed manager only loses the scene
+	bool ownsManager = false;
 };
 
@@ -0,0 +1,611 @@
+#include "MeshOptimizer.h"
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <glm/geometric.hpp>
+
+float MeshOptimizer::WeldVertices(std::vector<MeshData>& io_mesh, std::vector<int>& io_index)
+{
+	if (io_mesh.empty())
+	{
+		return 1.0f;
+	}
+
+	// Open addressing table holding indices of the unique vertices, kept at most half full
+	size_t bucketcount = 1;
+	while (bucketcount < io_mesh.size() * 2)
+	{
+		bucketcount <<= 1;
+	}
+	std::vector<int> buckets(bucketcount, -1);
+
+	std::vector<MeshData> unique;
+	unique.reserve(io_mesh.size());
+	std::vector<int> remap(io_mesh.size());
+
+	for (size_t i = 0; i < io_mesh.size(); i++)
+	{
+		size_t bucket = HashVertex(io_mesh[i]) & (bucketcount - 1);
+		while (buckets[bucket] != -1 && !IsSameVertex(unique[buckets[bucket]], io_mesh[i]))
+		{
+			bucket = (bucket + 1) & (bucketcount - 1);
+		}
+
+		if (buckets[bucket] == -1)
+		{
+			buckets[bucket] = static_cast<int>(unique.size());
+			unique.push_back(io_mesh[i]);
+		}
+		remap[i] = buckets[bucket];
+	}
+
+	for (size_t i = 0; i < io_index.size(); i++)
+	{
+		io_index[i] = remap[io_index[i]];
+	}
+
+	float ratio = static_cast<float>(io_mesh.size()) / unique.size();
+	printf("Welded %zu vertices into %zu (%.2fx)\n", io_mesh.size(), unique.size(), ratio);
+
+	io_mesh.swap(unique);
+	return ratio;
+}
+
+size_t MeshOptimizer::HashVertex(const MeshData& i_vertex)
+{
+	// FNV-1a over the bytes of every attribute that takes part in the comparison
+	const struct { const void* data; size_t size; } fields[] =
+	{
+		{ &i_vertex.vertex, sizeof(i_vertex.vertex) },
+		{ &i_vertex.normal, sizeof(i_vertex.normal) },
+		{ &i_vertex.uv,     sizeof(i_vertex.uv) },
+		{ &i_vertex.index,  sizeof(i_vertex.index) },
+		{ &i_vertex.weight, sizeof(i_vertex.weight) },
+	};
+
+	uint64_t hash = 14695981039346656037ull;
+	for (const auto& field : fields)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(field.data);
+		for (size_t i = 0; i < field.size; i++)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+	}
+	return static_cast<size_t>(hash);
+}
+
+bool MeshOptimizer::IsSameVertex(const MeshData& i_a, const MeshData& i_b)
+{
+	return memcmp(&i_a.vertex, &i_b.vertex, sizeof(i_a.vertex)) == 0
+		&& memcmp(&i_a.normal, &i_b.normal, sizeof(i_a.normal)) == 0
+		&& memcmp(&i_a.uv, &i_b.uv, sizeof(i_a.uv)) == 0
+		&& memcmp(&i_a.index, &i_b.index, sizeof(i_a.index)) == 0
+		&& memcmp(&i_a.weight, &i_b.weight, sizeof(i_a.weight)) == 0;
+}
+
+int MeshOptimizer::CountInfluences(const MeshData& i_vertex)
+{
+	int count = 0;
+	for (int k = 0; k < 4; k++)
+	{
+		if (i_vertex.index[k] >= 0 && i_vertex.weight[k] > 0.0f)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+void MeshOptimizer::PruneInfluences(std::vector<MeshData>& io_mesh, float i_threshold)
+{
+	size_t before[5] = {};
+	size_t after[5] = {};
+
+	for (MeshData& vertex : io_mesh)
+	{
+		before[CountInfluences(vertex)]++;
+
+		// Keep the surviving influences packed at the front, largest first like the importer writes them
+		int largest = 0;
+		for (int k = 1; k < 4; k++)
+		{
+			if (vertex.weight[k] > vertex.weight[largest])
+			{
+				largest = k;
+			}
+		}
+
+		glm::ivec4 index(-1, -1, -1, -1);
+		glm::vec4 weight(0, 0, 0, 0);
+		int count = 0;
+		float sum = 0.0f;
+		for (int k = 0; k < 4; k++)
+		{
+			if (vertex.index[k] < 0 || vertex.weight[k] <= 0.0f || (k != largest && vertex.weight[k] < i_threshold))
+			{
+				continue;
+			}
+			index[count] = vertex.index[k];
+			weight[count] = vertex.weight[k];
+			sum += vertex.weight[k];
+			count++;
+		}
+		for (int k = count - 1; k > 0 && weight[k] > weight[k - 1]; k--)
+		{
+			std::swap(index[k], index[k - 1]);
+			std::swap(weight[k], weight[k - 1]);
+		}
+
+		if (sum > 0.0f)
+		{
+			vertex.index = index;
+			vertex.weight = weight / sum;
+		}
+		else
+		{
+			// Weights that sum to nothing would collapse the vertex to the origin in a skinned range,
+			// it follows its first joint instead. Without any joint it stays unskinned.
+			for (int k = 0; k < 4; k++)
+			{
+				if (vertex.index[k] >= 0)
+				{
+					vertex.index = glm::ivec4(vertex.index[k], -1, -1, -1);
+					vertex.weight = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+					break;
+				}
+			}
+		}
+
+		after[CountInfluences(vertex)]++;
+	}
+
+	printf("Influences per vertex  0: %zu -> %zu, 1: %zu -> %zu, 2: %zu -> %zu, 3: %zu -> %zu, 4: %zu -> %zu\n",
+		before[0], after[0], before[1], after[1], before[2], after[2], before[3], after[3], before[4], after[4]);
+}
+
+void MeshOptimizer::BucketInfluences(const std::vector<MeshData>& i_mesh, std::vector<int>& io_index, std::vector<SubMesh>& io_submeshes)
+{
+	std::vector<MeshLod> whole(1);
+	whole[0].submesh_offset = 0;
+	whole[0].submesh_count = static_cast<int>(io_submeshes.size());
+	whole[0].error = 0.0f;
+	BucketInfluences(i_mesh, io_index, io_submeshes, whole);
+}
+
+void MeshOptimizer::BucketInfluences(const std::vector<MeshData>& i_mesh, std::vector<int>& io_index, std::vector<SubMesh>& io_submeshes, std::vector<MeshLod>& io_lods)
+{
+	std::vector<int> influences(i_mesh.size());
+	for (size_t i = 0; i < i_mesh.size(); i++)
+	{
+		influences[i] = CountInfluences(i_mesh[i]);
+	}
+
+	size_t triangles[5] = {};
+	std::vector<int> index;
+	std::vector<SubMesh> submeshes;
+	index.reserve(io_index.size());
+	submeshes.reserve(io_submeshes.size());
+
+	// Buckets follow each other inside their submesh, so the material order is kept
+	std::vector<int> bucket[5];
+	std::vector<int> firstrange(io_submeshes.size() + 1);
+	for (size_t s = 0; s < io_submeshes.size(); s++)
+	{
+		const SubMesh& submesh = io_submeshes[s];
+		firstrange[s] = static_cast<int>(submeshes.size());
+		for (int b = 0; b < 5; b++)
+		{
+			bucket[b].clear();
+		}
+
+		for (int t = 0; t < submesh.index_count; t += 3)
+		{
+			const int* corner = io_index.data() + submesh.index_offset + t;
+			int count = std::max(influences[corner[0]], std::max(influences[corner[1]], influences[corner[2]]));
+			bucket[count].insert(bucket[count].end(), corner, corner + 3);
+		}
+
+		for (int b = 0; b < 5; b++)
+		{
+			if (bucket[b].empty())
+			{
+				continue;
+			}
+
+			SubMesh range = submesh;
+			range.index_offset = static_cast<int>(index.size());
+			range.index_count = static_cast<int>(bucket[b].size());
+			range.influence_count = b;
+			range.bounds_min = i_mesh[bucket[b][0]].vertex;
+			range.bounds_max = i_mesh[bucket[b][0]].vertex;
+			for (int corner : bucket[b])
+			{
+				range.bounds_min = glm::min(range.bounds_min, i_mesh[corner].vertex);
+				range.bounds_max = glm::max(range.bounds_max, i_mesh[corner].vertex);
+			}
+
+			index.insert(index.end(), bucket[b].begin(), bucket[b].end());
+			submeshes.push_back(range);
+			triangles[b] += bucket[b].size() / 3;
+		}
+	}
+
+	firstrange[io_submeshes.size()] = static_cast<int>(submeshes.size());
+
+	for (MeshLod& lod : io_lods)
+	{
+		int end = firstrange[lod.submesh_offset + lod.submesh_count];
+		lod.submesh_offset = firstrange[lod.submesh_offset];
+		lod.submesh_count = end - lod.submesh_offset;
+	}
+
+	io_index.swap(index);
+	io_submeshes.swap(submeshes);
+
+	printf("Triangles per influence bucket  0: %zu, 1: %zu, 2: %zu, 3: %zu, 4: %zu, %zu draw ranges\n",
+		triangles[0], triangles[1], triangles[2], triangles[3], triangles[4], io_submeshes.size());
+}
+
+void MeshOptimizer::Optimize(std::vector<MeshData>& io_mesh, std::vector<int>& io_index)
+{
+	std::vector<SubMesh> whole(1);
+	whole[0].index_offset = 0;
+	whole[0].index_count = static_cast<int>(io_index.size());
+	Optimize(io_mesh, io_index, whole);
+}
+
+void MeshOptimizer::Optimize(std::vector<MeshData>& io_mesh, std::vector<int>& io_index, const std::vector<SubMesh>& i_submeshes)
+{
+	const int cachesize = 16;
+
+	float acmr_before, atvr_before;
+	AnalyzeVertexCache(io_index, io_mesh.size(), cachesize, acmr_before, atvr_before);
+
+	// Triangles are only reordered inside their submesh, so the draw ranges stay valid
+	std::vector<int> range;
+	for (const SubMesh& submesh : i_submeshes)
+	{
+		std::vector<int>::iterator begin = io_index.begin() + submesh.index_offset;
+		range.assign(begin, begin + submesh.index_count);
+		OptimizeVertexCache(range, io_mesh.size());
+		OptimizeOverdraw(io_mesh, range);
+		std::copy(range.begin(), range.end(), begin);
+	}
+	OptimizeVertexFetch(io_mesh, io_index);
+
+	float acmr_after, atvr_after;
+	AnalyzeVertexCache(io_index, io_mesh.size(), cachesize, acmr_after, atvr_after);
+
+	printf("Vertex cache %d: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", cachesize, acmr_before, acmr_after, atvr_before, atvr_after);
+}
+
+namespace
+{
+	const int   MaxCacheSize = 32;
+	const float CacheDecayPower = 1.5f;
+	const float LastTriangleScore = 0.75f;
+	const float ValenceBoostScale = 2.0f;
+	const float ValenceBoostPower = 0.5f;
+
+	float VertexScore(int i_cacheposition, int i_remaining)
+	{
+		if (i_remaining == 0)
+		{
+			return -1.0f;
+		}
+
+		float score = 0.0f;
+		if (i_cacheposition >= 0)
+		{
+			// The three vertices of the last triangle get a fixed score so they do not favour any winding
+			if (i_cacheposition < 3)
+			{
+				score = LastTriangleScore;
+			}
+			else
+			{
+				const float scaler = 1.0f / (MaxCacheSize - 3);
+				score = powf(1.0f - (i_cacheposition - 3) * scaler, CacheDecayPower);
+			}
+		}
+
+		// Vertices with few triangles left get a boost so that they are finished off
+		score += ValenceBoostScale * powf(static_cast<float>(i_remaining), -ValenceBoostPower);
+		return score;
+	}
+}
+
+void MeshOptimizer::OptimizeVertexCache(std::vector<int>& io_index, size_t i_vertexcount)
+{
+	const size_t trianglecount = io_index.size() / 3;
+	if (trianglecount == 0)
+	{
+		return;
+	}
+
+	// Triangles using each vertex, stored as CSR
+	std::vector<int> offsets(i_vertexcount + 1, 0);
+	for (size_t i = 0; i < trianglecount * 3; i++)
+	{
+		offsets[io_index[i] + 1]++;
+	}
+	for (size_t v = 0; v < i_vertexcount; v++)
+	{
+		offsets[v + 1] += offsets[v];
+	}
+
+	std::vector<int> adjacency(trianglecount * 3);
+	std::vector<int> remaining(i_vertexcount);
+	{
+		std::vector<int> cursor(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < trianglecount * 3; i++)
+		{
+			adjacency[cursor[io_index[i]]++] = static_cast<int>(i / 3);
+		}
+		for (size_t v = 0; v < i_vertexcount; v++)
+		{
+			remaining[v] = offsets[v + 1] - offsets[v];
+		}
+	}
+
+	std::vector<int> cacheposition(i_vertexcount, -1);
+	std::vector<float> vertexscore(i_vertexcount);
+	for (size_t v = 0; v < i_vertexcount; v++)
+	{
+		vertexscore[v] = VertexScore(-1, remaining[v]);
+	}
+
+	std::vector<bool> emitted(trianglecount, false);
+	std::vector<int> result;
+	result.reserve(io_index.size());
+
+	int cache[MaxCacheSize + 3];
+	int cachecount = 0;
+	size_t inputcursor = 0;
+
+	int besttriangle = -1;
+	float bestscore = -1.0f;
+	for (size_t t = 0; t < trianglecount; t++)
+	{
+		float score = vertexscore[io_index[3 * t + 0]] + vertexscore[io_index[3 * t + 1]] + vertexscore[io_index[3 * t + 2]];
+		if (score > bestscore)
+		{
+			bestscore = score;
+			besttriangle = static_cast<int>(t);
+		}
+	}
+
+	while (besttriangle >= 0)
+	{
+		const int a = io_index[3 * besttriangle + 0];
+		const int b = io_index[3 * besttriangle + 1];
+		const int c = io_index[3 * besttriangle + 2];
+
+		result.push_back(a);
+		result.push_back(b);
+		result.push_back(c);
+		emitted[besttriangle] = true;
+
+		// Push the triangle to the front of the cache and keep the rest in order
+		int newcache[MaxCacheSize + 3];
+		int newcachecount = 0;
+		newcache[newcachecount++] = a;
+		newcache[newcachecount++] = b;
+		newcache[newcachecount++] = c;
+		for (int i = 0; i < cachecount; i++)
+		{
+			int v = cache[i];
+			if (v != a && v != b && v != c)
+			{
+				newcache[newcachecount++] = v;
+			}
+		}
+
+		// Detach the triangle from its vertices
+		const int corners[3] = { a, b, c };
+		for (int k = 0; k < 3; k++)
+		{
+			int v = corners[k];
+			int* begin = adjacency.data() + offsets[v];
+			int* end = begin + remaining[v];
+			for (int* it = begin; it != end; ++it)
+			{
+				if (*it == besttriangle)
+				{
+					*it = *(end - 1);
+					break;
+				}
+			}
+			remaining[v]--;
+		}
+
+		// Rescore the cached vertices, evicted ones fall out of the cache
+		for (int i = 0; i < newcachecount; i++)
+		{
+			int v = newcache[i];
+			cacheposition[v] = i < MaxCacheSize ? i : -1;
+			vertexscore[v] = VertexScore(cacheposition[v], remaining[v]);
+		}
+		cachecount = newcachecount < MaxCacheSize ? newcachecount : MaxCacheSize;
+		memcpy(cache, newcache, cachecount * sizeof(int));
+
+		// The next triangle is searched among the ones touching the cache
+		besttriangle = -1;
+		bestscore = -1.0f;
+		for (int i = 0; i < newcachecount; i++)
+		{
+			int v = newcache[i];
+			for (int j = offsets[v]; j < offsets[v] + remaining[v]; j++)
+			{
+				int t = adjacency[j];
+				float score = vertexscore[io_index[3 * t + 0]] + vertexscore[io_index[3 * t + 1]] + vertexscore[io_index[3 * t + 2]];
+				if (score > bestscore)
+				{
+					bestscore = score;
+					besttriangle = t;
+				}
+			}
+		}
+
+		// Dead end, continue with the next triangle in input order
+		if (besttriangle < 0)
+		{
+			while (inputcursor < trianglecount && emitted[inputcursor])
+			{
+				inputcursor++;
+			}
+			if (inputcursor < trianglecount)
+			{
+				besttriangle = static_cast<int>(inputcursor);
+			}
+		}
+	}
+
+	io_index.swap(result);
+}
+
+void MeshOptimizer::OptimizeOverdraw(const std::vector<MeshData>& i_mesh, std::vector<int>& io_index)
+{
+	const size_t trianglecount = io_index.size() / 3;
+	if (trianglecount == 0)
+	{
+		return;
+	}
+
+	// A new cluster starts wherever the cache order had to restart, i.e. a triangle misses on all three vertices.
+	// Moving whole clusters around keeps almost all of the cache efficiency.
+	const int cachesize = 16;
+	std::vector<int> fifo(i_mesh.size(), -cachesize - 1);
+	int timestamp = 0;
+
+	std::vector<size_t> clusters;
+	for (size_t t = 0; t < trianglecount; t++)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			int v = io_index[3 * t + k];
+			if (timestamp - fifo[v] > cachesize)
+			{
+				fifo[v] = timestamp++;
+				misses++;
+			}
+		}
+
+		if (t == 0 || misses == 3)
+		{
+			clusters.push_back(t);
+		}
+	}
+	clusters.push_back(trianglecount);
+
+	// Area weighted centroid and normal of the mesh and of every cluster
+	struct Cluster
+	{
+		size_t    begin;
+		size_t    end;
+		float     sortkey;
+	};
+
+	glm::vec3 meshcentroid(0);
+	float mesharea = 0;
+	std::vector<Cluster> clusterdata(clusters.size() - 1);
+	std::vector<glm::vec3> centroids(clusterdata.size(), glm::vec3(0));
+	std::vector<glm::vec3> normals(clusterdata.size(), glm::vec3(0));
+
+	for (size_t c = 0; c + 1 < clusters.size(); c++)
+	{
+		float clusterarea = 0;
+		for (size_t t = clusters[c]; t < clusters[c + 1]; t++)
+		{
+			const glm::vec3& p0 = i_mesh[io_index[3 * t + 0]].vertex;
+			const glm::vec3& p1 = i_mesh[io_index[3 * t + 1]].vertex;
+			const glm::vec3& p2 = i_mesh[io_index[3 * t + 2]].vertex;
+
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			glm::vec3 center = (p0 + p1 + p2) / 3.0f;
+
+			centroids[c] += center * area;
+			normals[c] += normal;
+			clusterarea += area;
+		}
+
+		meshcentroid += centroids[c];
+		mesharea += clusterarea;
+		if (clusterarea > 0)
+		{
+			centroids[c] /= clusterarea;
+		}
+	}
+	if (mesharea > 0)
+	{
+		meshcentroid /= mesharea;
+	}
+
+	for (size_t c = 0; c < clusterdata.size(); c++)
+	{
+		float length = glm::length(normals[c]);
+		glm::vec3 normal = length > 0 ? normals[c] / length : glm::vec3(0);
+
+		clusterdata[c].begin = clusters[c];
+		clusterdata[c].end = clusters[c + 1];
+		clusterdata[c].sortkey = glm::dot(centroids[c] - meshcentroid, normal);
+	}
+
+	// Clusters facing away from the center are the most likely to occlude the rest
+	std::stable_sort(clusterdata.begin(), clusterdata.end(), [](const Cluster& a, const Cluster& b)
+	{
+		return a.sortkey > b.sortkey;
+	});
+
+	std::vector<int> result;
+	result.reserve(io_index.size());
+	for (const Cluster& cluster : clusterdata)
+	{
+		result.insert(result.end(), io_index.begin() + 3 * cluster.begin, io_index.begin() + 3 * cluster.end);
+	}
+	io_index.swap(result);
+}
+
+void MeshOptimizer::OptimizeVertexFetch(std::vector<MeshData>& io_mesh, std::vector<int>& io_index)
+{
+	std::vector<int> remap(io_mesh.size(), -1);
+	std::vector<MeshData> result;
+	result.reserve(io_mesh.size());
+
+	for (size_t i = 0; i < io_index.size(); i++)
+	{
+		int& v = io_index[i];
+		if (remap[v] == -1)
+		{
+			remap[v] = static_cast<int>(result.size());
+			result.push_back(io_mesh[v]);
+		}
+		v = remap[v];
+	}
+
+	io_mesh.swap(result);
+}
+
+void MeshOptimizer::AnalyzeVertexCache(const std::vector<int>& i_index, size_t i_vertexcount, int i_cachesize, float& o_acmr, float& o_atvr)
+{
+	std::vector<int> fifo(i_vertexcount, -i_cachesize - 1);
+	int timestamp = 0;
+
+	for (size_t i = 0; i < i_index.size(); i++)
+	{
+		int v = i_index[i];
+		if (timestamp - fifo[v] > i_cachesize)
+		{
+			fifo[v] = timestamp++;
+		}
+	}
+
+	size_t trianglecount = i_index.size() / 3;
+	o_acmr = trianglecount ? static_cast<float>(timestamp) / trianglecount : 0.0f;
+	o_atvr = i_vertexcount ? static_cast<float>(timestamp) / i_vertexcount : 0.0f;
+}
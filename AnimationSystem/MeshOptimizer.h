@@ -0,0 +1,43 @@
+#pragma once
+#include "SceneProxy.h"
+
+class MeshOptimizer
+{
+public:
+	// Merge vertices whose position, normal, uv, joint indices and weights are identical,
+	// and rewrite the index buffer to point at the shared vertices.
+	// Returns the number of input vertices per output vertex.
+	static float WeldVertices(std::vector<MeshData>& io_mesh, std::vector<int>& io_index);
+
+	// Drop skinning influences below i_threshold and renormalize the rest, the largest influence is always kept.
+	// Prints the histogram of influences per vertex before and after.
+	static void PruneInfluences(std::vector<MeshData>& io_mesh, float i_threshold = 0.01f);
+
+	// Split every submesh into ranges of triangles that need 0, 1, 2, 3 or 4 influences, so each range
+	// can be skinned with a fixed influence count. A triangle needs the most influences of its vertices.
+	// The levels of detail are moved to the split submesh table.
+	static void BucketInfluences(const std::vector<MeshData>& i_mesh, std::vector<int>& io_index, std::vector<SubMesh>& io_submeshes);
+	static void BucketInfluences(const std::vector<MeshData>& i_mesh, std::vector<int>& io_index, std::vector<SubMesh>& io_submeshes, std::vector<MeshLod>& io_lods);
+
+	// Cook time reordering, runs the three passes below and prints the cache statistics before and after.
+	// With submeshes, triangles are reordered within each draw range only.
+	static void Optimize(std::vector<MeshData>& io_mesh, std::vector<int>& io_index);
+	static void Optimize(std::vector<MeshData>& io_mesh, std::vector<int>& io_index, const std::vector<SubMesh>& i_submeshes);
+
+	// Reorder triangles for the post-transform vertex cache (Forsyth's linear-speed algorithm)
+	static void OptimizeVertexCache(std::vector<int>& io_index, size_t i_vertexcount);
+
+	// Split a cache optimized index buffer into clusters and draw outward facing clusters first
+	static void OptimizeOverdraw(const std::vector<MeshData>& i_mesh, std::vector<int>& io_index);
+
+	// Reorder vertices by first use so the vertex fetch walks memory linearly, unused vertices are dropped
+	static void OptimizeVertexFetch(std::vector<MeshData>& io_mesh, std::vector<int>& io_index);
+
+	// Average cache miss per triangle and average transformed vertex per vertex, with a FIFO cache
+	static void AnalyzeVertexCache(const std::vector<int>& i_index, size_t i_vertexcount, int i_cachesize, float& o_acmr, float& o_atvr);
+
+private:
+	static int CountInfluences(const MeshData&);
+	static size_t HashVertex(const MeshData&);
+	static bool IsSameVertex(const MeshData&, const MeshData&);
+};
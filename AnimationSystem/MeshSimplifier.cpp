@@ -0,0 +1,451 @@
+#include "MeshSimplifier.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <utility>
+#include <glm/geometric.hpp>
+
+namespace
+{
+	// Penalties are in squared units of the simplified range's extent, like the quadric error.
+	// Moving all the weight to other joints costs as much as moving the surface by a tenth of the mesh,
+	// a collapse that adds or removes a joint costs as much as two hundredths more.
+	const double SkinWeightPenalty = 0.01;
+	const double JointSetPenalty = 0.0004;
+
+	// A level that keeps more than this of the triangles of the level before ends the chain
+	const float MinimumReduction = 0.9f;
+
+	struct Collapse
+	{
+		int    from;
+		int    to;
+		double error; // quadric error alone
+		double cost;  // error plus skin penalty, orders the collapses
+	};
+
+	bool IsDegenerate(const int* i_triangle)
+	{
+		return i_triangle[0] == i_triangle[1] || i_triangle[1] == i_triangle[2] || i_triangle[0] == i_triangle[2];
+	}
+
+	// Give vertices at the same position the same id, so seams and borders are found on the surface and not on the uv layout
+	size_t BuildPositionIds(const std::vector<MeshData>& i_mesh, const std::vector<int>& i_index, std::vector<int>& o_positionid)
+	{
+		std::vector<int> vertices(i_index);
+		std::sort(vertices.begin(), vertices.end());
+		vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+
+		std::sort(vertices.begin(), vertices.end(), [&](int a, int b)
+		{
+			const glm::vec3& pa = i_mesh[a].vertex;
+			const glm::vec3& pb = i_mesh[b].vertex;
+			return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+		});
+
+		o_positionid.assign(i_mesh.size(), -1);
+		int id = -1;
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			if (i == 0 || i_mesh[vertices[i]].vertex != i_mesh[vertices[i - 1]].vertex)
+			{
+				id++;
+			}
+			o_positionid[vertices[i]] = id;
+		}
+		return static_cast<size_t>(id + 1);
+	}
+}
+
+void MeshSimplifier::AddPlane(Quadric& io_quadric, const glm::dvec3& i_normal, double i_distance, double i_weight)
+{
+	io_quadric.a00 += i_weight * i_normal.x * i_normal.x;
+	io_quadric.a01 += i_weight * i_normal.x * i_normal.y;
+	io_quadric.a02 += i_weight * i_normal.x * i_normal.z;
+	io_quadric.a11 += i_weight * i_normal.y * i_normal.y;
+	io_quadric.a12 += i_weight * i_normal.y * i_normal.z;
+	io_quadric.a22 += i_weight * i_normal.z * i_normal.z;
+	io_quadric.b0 += i_weight * i_normal.x * i_distance;
+	io_quadric.b1 += i_weight * i_normal.y * i_distance;
+	io_quadric.b2 += i_weight * i_normal.z * i_distance;
+	io_quadric.c += i_weight * i_distance * i_distance;
+	io_quadric.weight += i_weight;
+}
+
+void MeshSimplifier::AddQuadric(Quadric& io_quadric, const Quadric& i_other)
+{
+	io_quadric.a00 += i_other.a00;
+	io_quadric.a01 += i_other.a01;
+	io_quadric.a02 += i_other.a02;
+	io_quadric.a11 += i_other.a11;
+	io_quadric.a12 += i_other.a12;
+	io_quadric.a22 += i_other.a22;
+	io_quadric.b0 += i_other.b0;
+	io_quadric.b1 += i_other.b1;
+	io_quadric.b2 += i_other.b2;
+	io_quadric.c += i_other.c;
+	io_quadric.weight += i_other.weight;
+}
+
+// Area weighted mean of the squared distances to the planes
+double MeshSimplifier::Error(const Quadric& i_quadric, const glm::dvec3& i_position)
+{
+	const glm::dvec3& p = i_position;
+	double error = i_quadric.a00 * p.x * p.x + i_quadric.a11 * p.y * p.y + i_quadric.a22 * p.z * p.z
+		+ 2.0 * (i_quadric.a01 * p.x * p.y + i_quadric.a02 * p.x * p.z + i_quadric.a12 * p.y * p.z)
+		+ 2.0 * (i_quadric.b0 * p.x + i_quadric.b1 * p.y + i_quadric.b2 * p.z)
+		+ i_quadric.c;
+	return i_quadric.weight > 0.0 ? std::max(error, 0.0) / i_quadric.weight : 0.0;
+}
+
+double MeshSimplifier::SkinPenalty(const MeshData& i_from, const MeshData& i_to)
+{
+	// Squared difference of the weight per joint over the joints of both vertices
+	double difference = 0.0;
+	bool samejoints = true;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		const MeshData& a = pass == 0 ? i_from : i_to;
+		const MeshData& b = pass == 0 ? i_to : i_from;
+		for (int k = 0; k < 4; k++)
+		{
+			if (a.index[k] < 0 || a.weight[k] <= 0.0f)
+			{
+				continue;
+			}
+
+			float other = 0.0f;
+			for (int l = 0; l < 4; l++)
+			{
+				if (b.index[l] == a.index[k])
+				{
+					other = b.weight[l];
+				}
+			}
+			if (other <= 0.0f)
+			{
+				samejoints = false;
+			}
+
+			// Joints in both vertices are counted twice
+			double delta = a.weight[k] - other;
+			difference += other > 0.0f ? 0.5 * delta * delta : delta * delta;
+		}
+	}
+
+	return SkinWeightPenalty * difference + (samejoints ? 0.0 : JointSetPenalty);
+}
+
+float MeshSimplifier::Simplify(const std::vector<MeshData>& i_mesh, std::vector<int>& io_index, size_t i_targetindexcount)
+{
+	if (io_index.size() <= i_targetindexcount || io_index.empty())
+	{
+		return 0.0f;
+	}
+
+	// Work in the unit box of the range, so the penalties do not depend on the size of the model
+	glm::vec3 boundsmin = i_mesh[io_index[0]].vertex;
+	glm::vec3 boundsmax = boundsmin;
+	for (int vertex : io_index)
+	{
+		boundsmin = glm::min(boundsmin, i_mesh[vertex].vertex);
+		boundsmax = glm::max(boundsmax, i_mesh[vertex].vertex);
+	}
+	const glm::vec3 extent = boundsmax - boundsmin;
+	const double scale = std::max(extent.x, std::max(extent.y, extent.z));
+	if (scale <= 0.0)
+	{
+		return 0.0f;
+	}
+
+	const size_t vertexcount = i_mesh.size();
+	std::vector<glm::dvec3> position(vertexcount);
+	for (int vertex : io_index)
+	{
+		position[vertex] = glm::dvec3(i_mesh[vertex].vertex - boundsmin) / scale;
+	}
+
+	// Vertices on a uv or normal seam, on an open border or on a non manifold edge never move,
+	// so levels stay closed against each other and against the neighbouring submeshes
+	std::vector<int> positionid;
+	const size_t positioncount = BuildPositionIds(i_mesh, io_index, positionid);
+
+	std::vector<char> lockedposition(positioncount, 0);
+	{
+		std::vector<int> copies(positioncount, 0);
+		std::vector<char> counted(vertexcount, 0);
+		for (int vertex : io_index)
+		{
+			if (!counted[vertex])
+			{
+				counted[vertex] = 1;
+				copies[positionid[vertex]]++;
+			}
+		}
+
+		std::vector<std::pair<int, int>> edges;
+		edges.reserve(io_index.size());
+		for (size_t i = 0; i < io_index.size(); i += 3)
+		{
+			for (int e = 0; e < 3; e++)
+			{
+				int a = positionid[io_index[i + e]];
+				int b = positionid[io_index[i + (e + 1) % 3]];
+				edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+
+		for (size_t i = 0; i < edges.size();)
+		{
+			size_t j = i;
+			while (j < edges.size() && edges[j] == edges[i])
+			{
+				j++;
+			}
+			if (j - i != 2)
+			{
+				lockedposition[edges[i].first] = 1;
+				lockedposition[edges[i].second] = 1;
+			}
+			i = j;
+		}
+
+		for (size_t i = 0; i < positioncount; i++)
+		{
+			if (copies[i] > 1)
+			{
+				lockedposition[i] = 1;
+			}
+		}
+	}
+
+	// Every vertex starts with the planes of its triangles
+	std::vector<Quadric> quadrics(vertexcount, Quadric());
+	for (size_t i = 0; i < io_index.size(); i += 3)
+	{
+		const glm::dvec3& p0 = position[io_index[i + 0]];
+		const glm::dvec3& p1 = position[io_index[i + 1]];
+		const glm::dvec3& p2 = position[io_index[i + 2]];
+		glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+		double area = glm::length(normal);
+		if (area <= 0.0)
+		{
+			continue;
+		}
+		normal /= area;
+		for (int k = 0; k < 3; k++)
+		{
+			AddPlane(quadrics[io_index[i + k]], normal, -glm::dot(normal, p0), area);
+		}
+	}
+
+	const size_t targettriangles = i_targetindexcount / 3;
+	double maxerror = 0.0;
+
+	std::vector<int> offsets(vertexcount + 1);
+	std::vector<int> adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<int> remap(vertexcount);
+	std::vector<char> touched(vertexcount);
+
+	// Each pass collapses the cheapest edges whose neighbourhoods do not overlap, then rebuilds the adjacency
+	while (io_index.size() / 3 > targettriangles)
+	{
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (int vertex : io_index)
+		{
+			offsets[vertex + 1]++;
+		}
+		for (size_t i = 0; i < vertexcount; i++)
+		{
+			offsets[i + 1] += offsets[i];
+		}
+		adjacency.resize(io_index.size());
+		{
+			std::vector<int> cursor(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < io_index.size(); i++)
+			{
+				adjacency[cursor[io_index[i]]++] = static_cast<int>(i / 3);
+			}
+		}
+
+		collapses.clear();
+		for (size_t i = 0; i < io_index.size(); i += 3)
+		{
+			for (int e = 0; e < 3; e++)
+			{
+				int a = io_index[i + e];
+				int b = io_index[i + (e + 1) % 3];
+				if (!lockedposition[positionid[a]])
+				{
+					double error = Error(quadrics[a], position[b]);
+					collapses.push_back({ a, b, error, error + SkinPenalty(i_mesh[a], i_mesh[b]) });
+				}
+				if (!lockedposition[positionid[b]])
+				{
+					double error = Error(quadrics[b], position[a]);
+					collapses.push_back({ b, a, error, error + SkinPenalty(i_mesh[b], i_mesh[a]) });
+				}
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+		if (collapses.empty())
+		{
+			break;
+		}
+
+		// A pass only takes collapses about as cheap as the ones it needs, otherwise expensive edges whose
+		// neighbourhood happens to be free would go before cheap edges blocked by an earlier collapse.
+		// Every collapse removes about two triangles and every edge is listed by both of its triangles.
+		size_t goal = std::min(collapses.size() - 1, (io_index.size() / 3 - targettriangles));
+		const double passlimit = collapses[goal].cost * 1.5;
+
+		for (size_t i = 0; i < vertexcount; i++)
+		{
+			remap[i] = static_cast<int>(i);
+		}
+		std::fill(touched.begin(), touched.end(), 0);
+
+		size_t triangles = io_index.size() / 3;
+		size_t collapsed = 0;
+		for (const Collapse& collapse : collapses)
+		{
+			if (triangles <= targettriangles || collapse.cost > passlimit)
+			{
+				break;
+			}
+			if (touched[collapse.from] || touched[collapse.to])
+			{
+				continue;
+			}
+
+			// Triangles that keep their area must not turn over
+			size_t removed = 0;
+			bool flips = false;
+			for (int t = offsets[collapse.from]; t < offsets[collapse.from + 1] && !flips; t++)
+			{
+				const int* triangle = io_index.data() + adjacency[t] * 3;
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+				{
+					removed++;
+					continue;
+				}
+
+				glm::dvec3 before[3];
+				glm::dvec3 after[3];
+				for (int k = 0; k < 3; k++)
+				{
+					before[k] = position[triangle[k]];
+					after[k] = triangle[k] == collapse.from ? position[collapse.to] : before[k];
+				}
+				glm::dvec3 normalbefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+				glm::dvec3 normalafter = glm::cross(after[1] - after[0], after[2] - after[0]);
+				flips = glm::dot(normalbefore, normalafter) <= 0.0;
+			}
+			if (flips)
+			{
+				continue;
+			}
+
+			remap[collapse.from] = collapse.to;
+			AddQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+			maxerror = std::max(maxerror, collapse.error);
+			triangles -= removed;
+			collapsed++;
+
+			for (int t = offsets[collapse.from]; t < offsets[collapse.from + 1]; t++)
+			{
+				const int* triangle = io_index.data() + adjacency[t] * 3;
+				touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+			}
+		}
+
+		if (collapsed == 0)
+		{
+			break;
+		}
+
+		size_t write = 0;
+		for (size_t i = 0; i < io_index.size(); i += 3)
+		{
+			int triangle[3] = { remap[io_index[i + 0]], remap[io_index[i + 1]], remap[io_index[i + 2]] };
+			if (IsDegenerate(triangle))
+			{
+				continue;
+			}
+			io_index[write++] = triangle[0];
+			io_index[write++] = triangle[1];
+			io_index[write++] = triangle[2];
+		}
+		io_index.resize(write);
+	}
+
+	return static_cast<float>(std::sqrt(maxerror) * scale);
+}
+
+void MeshSimplifier::BuildLodChain(const std::vector<MeshData>& i_mesh, std::vector<int>& io_index, std::vector<SubMesh>& io_submeshes, std::vector<MeshLod>& o_lods, int i_maxlods)
+{
+	o_lods.clear();
+
+	MeshLod base;
+	base.submesh_offset = 0;
+	base.submesh_count = static_cast<int>(io_submeshes.size());
+	base.error = 0.0f;
+	o_lods.push_back(base);
+
+	size_t previoustriangles = io_index.size() / 3;
+	printf("LOD 0: %zu triangles\n", previoustriangles);
+
+	std::vector<int> range;
+	for (int level = 1; level <= i_maxlods; level++)
+	{
+		const MeshLod previous = o_lods.back();
+		const size_t indexcount = io_index.size();
+		const size_t submeshcount = io_submeshes.size();
+
+		// Errors only grow along the chain, every level is simplified from the one before
+		MeshLod lod;
+		lod.submesh_offset = static_cast<int>(submeshcount);
+		lod.submesh_count = 0;
+		lod.error = previous.error;
+
+		for (int s = previous.submesh_offset; s < previous.submesh_offset + previous.submesh_count; s++)
+		{
+			SubMesh submesh = io_submeshes[s];
+			range.assign(io_index.begin() + submesh.index_offset, io_index.begin() + submesh.index_offset + submesh.index_count);
+			lod.error = std::max(lod.error, Simplify(i_mesh, range, range.size() / 6 * 3));
+			if (range.empty())
+			{
+				continue;
+			}
+
+			submesh.index_offset = static_cast<int>(io_index.size());
+			submesh.index_count = static_cast<int>(range.size());
+			submesh.bounds_min = i_mesh[range[0]].vertex;
+			submesh.bounds_max = i_mesh[range[0]].vertex;
+			for (int vertex : range)
+			{
+				submesh.bounds_min = glm::min(submesh.bounds_min, i_mesh[vertex].vertex);
+				submesh.bounds_max = glm::max(submesh.bounds_max, i_mesh[vertex].vertex);
+			}
+
+			io_index.insert(io_index.end(), range.begin(), range.end());
+			io_submeshes.push_back(submesh);
+			lod.submesh_count++;
+		}
+
+		// Locked borders and seams eventually stop the simplification, a level that barely changes is not worth drawing
+		size_t triangles = (io_index.size() - indexcount) / 3;
+		if (triangles == 0 || triangles > previoustriangles * MinimumReduction)
+		{
+			io_index.resize(indexcount);
+			io_submeshes.resize(submeshcount);
+			break;
+		}
+
+		printf("LOD %d: %zu triangles, error %f\n", level, triangles, lod.error);
+		o_lods.push_back(lod);
+		previoustriangles = triangles;
+	}
+}
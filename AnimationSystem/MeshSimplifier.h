@@ -0,0 +1,32 @@
+#pragma once
+#include "SceneProxy.h"
+
+// Quadric error edge collapse for building levels of detail.
+// Vertices are collapsed onto a neighbour and keep its attributes, so every level indexes the same vertex buffer.
+// Besides the geometric error, a collapse pays for the skin weights and joints it changes, so the simplified
+// surface still deforms like the original.
+class MeshSimplifier
+{
+public:
+	// Collapse edges of one triangle list until it has at most i_targetindexcount indices or nothing can be collapsed.
+	// Returns the largest geometric error of the collapses made, in model units. Skin penalties only decide the order of the collapses.
+	static float Simplify(const std::vector<MeshData>& i_mesh, std::vector<int>& io_index, size_t i_targetindexcount);
+
+	// Append up to i_maxlods simplified copies of the submeshes to the index buffer and submesh table,
+	// each with about half the triangles of the level before. o_lods[0] is the original mesh.
+	static void BuildLodChain(const std::vector<MeshData>& i_mesh, std::vector<int>& io_index, std::vector<SubMesh>& io_submeshes, std::vector<MeshLod>& o_lods, int i_maxlods = 4);
+
+private:
+	struct Quadric
+	{
+		double a00, a01, a02, a11, a12, a22, b0, b1, b2, c;
+		double weight;
+	};
+
+	static void AddPlane(Quadric& io_quadric, const glm::dvec3& i_normal, double i_distance, double i_weight);
+	static void AddQuadric(Quadric& io_quadric, const Quadric& i_other);
+	static double Error(const Quadric& i_quadric, const glm::dvec3& i_position);
+
+	// Cost of moving i_from's skinning onto i_to's
+	static double SkinPenalty(const MeshData& i_from, const MeshData& i_to);
+};
@@ -0,0 +1,272 @@
+#include "Profiler.h"
+#include <fbxsdk.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <new>
+
+namespace
+{
+	thread_local uint64_t ThreadAllocations = 0;
+	thread_local uint64_t ThreadBytes = 0;
+
+	FbxMallocProc  FbxDefaultMalloc = nullptr;
+	FbxCallocProc  FbxDefaultCalloc = nullptr;
+	FbxReallocProc FbxDefaultRealloc = nullptr;
+
+	void CountAllocation(size_t i_size)
+	{
+		ThreadAllocations++;
+		ThreadBytes += i_size;
+	}
+
+	void* CountingFbxMalloc(size_t i_size)
+	{
+		CountAllocation(i_size);
+		return FbxDefaultMalloc(i_size);
+	}
+
+	void* CountingFbxCalloc(size_t i_count, size_t i_size)
+	{
+		CountAllocation(i_count * i_size);
+		return FbxDefaultCalloc(i_count, i_size);
+	}
+
+	void* CountingFbxRealloc(void* i_data, size_t i_size)
+	{
+		CountAllocation(i_size);
+		return FbxDefaultRealloc(i_data, i_size);
+	}
+
+	int64_t Microseconds()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Asset names are file paths, which have backslashes on windows
+	void WriteJsonString(std::ofstream& o_file, const std::string& i_string)
+	{
+		o_file << '"';
+		for (char c : i_string)
+		{
+			if (c == '"' || c == '\\')
+			{
+				o_file << '\\' << c;
+			}
+			else if (static_cast<unsigned char>(c) < 0x20)
+			{
+				o_file << ' ';
+			}
+			else
+			{
+				o_file << c;
+			}
+		}
+		o_file << '"';
+	}
+}
+
+// Every allocation of the program goes through the counters, which only cost two thread local increments
+void* operator new(size_t i_size)
+{
+	CountAllocation(i_size);
+	if (void* memory = std::malloc(i_size ? i_size : 1))
+	{
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* i_memory) noexcept
+{
+	std::free(i_memory);
+}
+
+void operator delete(void* i_memory, size_t) noexcept
+{
+	operator delete(i_memory);
+}
+
+Profiler& Profiler::Get()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Profiler() :
+	enabled(false),
+	epoch(Microseconds())
+{
+}
+
+uint64_t Profiler::Now() const
+{
+	return static_cast<uint64_t>(Microseconds() - epoch);
+}
+
+void Profiler::Record(Event&& i_event)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	events.push_back(std::move(i_event));
+}
+
+void Profiler::Clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	events.clear();
+}
+
+bool Profiler::WriteTrace(const char* i_filepath) const
+{
+	std::ofstream file(i_filepath, std::ios::trunc);
+	if (!file)
+	{
+		printf("Cannot write %s\n", i_filepath);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Complete events, "X" with a start and a duration in microseconds
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		const Event& event = events[i];
+		file << (i ? ",\n" : "\n") << "{\"name\":\"" << event.name << "\",\"cat\":\"import\",\"ph\":\"X\",\"pid\":1"
+			<< ",\"tid\":" << event.thread << ",\"ts\":" << event.start << ",\"dur\":" << event.duration
+			<< ",\"args\":{\"asset\":";
+		WriteJsonString(file, event.asset);
+		file << ",\"allocations\":" << event.allocations << ",\"bytes\":" << event.bytes << "}}";
+	}
+	file << "\n]}\n";
+
+	return static_cast<bool>(file);
+}
+
+void Profiler::PrintSummary() const
+{
+	struct Stage
+	{
+		uint64_t calls = 0;
+		uint64_t time = 0;
+		uint64_t longest = 0;
+		uint64_t allocations = 0;
+		uint64_t bytes = 0;
+	};
+
+	std::map<std::string, std::map<std::string, Stage>> assets;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const Event& event : events)
+		{
+			Stage& stage = assets[event.asset][event.name];
+			stage.calls++;
+			stage.time += event.duration;
+			stage.longest = std::max(stage.longest, event.duration);
+			stage.allocations += event.allocations;
+			stage.bytes += event.bytes;
+		}
+	}
+
+	// Time is summed over threads, stages that run on the pool can take longer than the import did
+	for (const auto& asset : assets)
+	{
+		uint64_t total = 0;
+		for (const auto& stage : asset.second)
+		{
+			total += stage.second.time;
+		}
+
+		std::vector<std::pair<std::string, Stage>> stages(asset.second.begin(), asset.second.end());
+		std::sort(stages.begin(), stages.end(), [](const std::pair<std::string, Stage>& a, const std::pair<std::string, Stage>& b)
+		{
+			return a.second.time > b.second.time;
+		});
+
+		printf("%s\n", asset.first.c_str());
+		printf("  %-16s %8s %12s %7s %12s %12s %10s\n", "stage", "calls", "cpu ms", "share", "longest ms", "allocations", "MB");
+		for (const auto& stage : stages)
+		{
+			printf("  %-16s %8llu %12.3f %6.1f%% %12.3f %12llu %10.3f\n", stage.first.c_str(),
+				static_cast<unsigned long long>(stage.second.calls),
+				stage.second.time / 1000.0,
+				total ? 100.0 * stage.second.time / total : 0.0,
+				stage.second.longest / 1000.0,
+				static_cast<unsigned long long>(stage.second.allocations),
+				stage.second.bytes / (1024.0 * 1024.0));
+		}
+	}
+}
+
+uint64_t Profiler::AllocationCount()
+{
+	return ThreadAllocations;
+}
+
+uint64_t Profiler::AllocatedBytes()
+{
+	return ThreadBytes;
+}
+
+void Profiler::InstallFbxAllocator()
+{
+	static std::once_flag installed;
+	std::call_once(installed, []()
+	{
+		FbxDefaultMalloc = FbxGetMallocHandler();
+		FbxDefaultCalloc = FbxGetCallocHandler();
+		FbxDefaultRealloc = FbxGetReallocHandler();
+		FbxSetMallocHandler(CountingFbxMalloc);
+		FbxSetCallocHandler(CountingFbxCalloc);
+		FbxSetReallocHandler(CountingFbxRealloc);
+	});
+}
+
+uint32_t Profiler::ThreadId()
+{
+	static std::atomic<uint32_t> next(0);
+	thread_local uint32_t id = next++;
+	return id;
+}
+
+ProfileScope::ProfileScope(const char* i_name, const std::string& i_asset) :
+	name(i_name),
+	asset(i_asset),
+	enabled(Profiler::Get().IsEnabled()),
+	start(0),
+	allocations(0),
+	bytes(0)
+{
+	if (enabled)
+	{
+		start = Profiler::Get().Now();
+		allocations = Profiler::AllocationCount();
+		bytes = Profiler::AllocatedBytes();
+	}
+}
+
+ProfileScope::~ProfileScope()
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	// Counters are read before the event itself allocates
+	uint64_t end = Profiler::Get().Now();
+	uint64_t allocated = Profiler::AllocationCount() - allocations;
+	uint64_t allocatedbytes = Profiler::AllocatedBytes() - bytes;
+
+	Profiler::Event event;
+	event.name = name;
+	event.asset = asset;
+	event.start = start;
+	event.duration = end - start;
+	event.thread = Profiler::ThreadId();
+	event.allocations = allocated;
+	event.bytes = allocatedbytes;
+	Profiler::Get().Record(std::move(event));
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scoped timers and allocation counters for the import stages.
+// Events are written as a Chrome trace (chrome://tracing or ui.perfetto.dev) and summed into a table per asset and stage.
+// Allocations are counted per thread, through operator new and the fbx sdk allocator.
+class Profiler
+{
+public:
+	struct Event
+	{
+		const char* name;     // stage, a string literal
+		std::string asset;
+		uint64_t    start;    // microseconds since the profiler was created
+		uint64_t    duration;
+		uint32_t    thread;
+		uint64_t    allocations;
+		uint64_t    bytes;
+	};
+
+	// Profiler shared by every importer
+	static Profiler& Get();
+
+	// Off by default, a disabled scope does not read the clock
+	void Enable(bool i_enabled)
+	{
+		enabled = i_enabled;
+	}
+	bool IsEnabled() const
+	{
+		return enabled;
+	}
+
+	void Record(Event&& i_event);
+	void Clear();
+
+	bool WriteTrace(const char* i_filepath) const;
+
+	// Time, call count and allocations of every stage per asset, stages of one asset sorted by time
+	void PrintSummary() const;
+
+	uint64_t Now() const;
+
+	// Number and bytes of the allocations the calling thread has made so far
+	static uint64_t AllocationCount();
+	static uint64_t AllocatedBytes();
+
+	// Count the fbx sdk allocations too, has to run before the first FbxManager is created
+	static void InstallFbxAllocator();
+
+	// Small id of the calling thread for the trace
+	static uint32_t ThreadId();
+
+private:
+	Profiler();
+
+	std::atomic<bool> enabled;
+	int64_t epoch;
+
+	mutable std::mutex mutex;
+	std::vector<Event> events;
+};
+
+// Records the time and allocations between construction and destruction as one event
+class ProfileScope
+{
+public:
+	ProfileScope(const char* i_name, const std::string& i_asset);
+	~ProfileScope();
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	const char*        name;
+	const std::string& asset;
+	bool               enabled;
+	uint64_t           start;
+	uint64_t           allocations;
+	uint64_t           bytes;
+};
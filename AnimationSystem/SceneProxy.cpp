@@ -1,12 +1,46 @@
 #pragma once
 #include "SceneProxy.h"
+#include <cstddef>
 
 
 void SceneProxy::Draw()
 {
 	glBindVertexArray(vertexarrayid);
-	glDrawElements(static_cast<unsigned int>(drawtype), indexsize, GL_UNSIGNED_INT, (void*)0);
+	if (submeshes.empty())
+	{
+		if (influencelocation != -1)
+		{
+			glUniform1i(influencelocation, 4);
+		}
+		glDrawElements(static_cast<unsigned int>(drawtype), indexsize, GL_UNSIGNED_INT, (void*)0);
+		return;
+	}
+
+	if (lods.empty())
+	{
+		for (size_t i = 0; i < submeshes.size(); i++)
+		{
+			DrawSubMesh(i);
+		}
+		return;
+	}
 
+	const MeshLod& current = lods[lod];
+	for (int i = current.submesh_offset; i < current.submesh_offset + current.submesh_count; i++)
+	{
+		DrawSubMesh(i);
+	}
+}
+
+// Draw one range of the index buffer, the vertex array has to be bound already
+void SceneProxy::DrawSubMesh(size_t i_submesh)
+{
+	const SubMesh& submesh = submeshes[i_submesh];
+	if (influencelocation != -1)
+	{
+		glUniform1i(influencelocation, submesh.influence_count);
+	}
+	glDrawElements(static_cast<unsigned int>(drawtype), submesh.index_count, GL_UNSIGNED_INT, (void*)(submesh.index_offset * sizeof(int)));
 }
 
 void SceneProxy::DrawPoint()
@@ -46,10 +80,16 @@ void SceneProxy::InitBuffer()
 }
 
 void SceneProxy::InitMeshData(std::vector<MeshData> mesh, std::vector<int> index)
+{
+	InitMeshData(mesh.data(), mesh.size(), index.data(), index.size());
+}
+
+// Takes raw arrays so that cooked data can be uploaded straight from the mapped file
+void SceneProxy::InitMeshData(const MeshData* mesh, size_t meshcount, const int* index, size_t indexcount)
 {
 	// Set vertex data to vertex buffer, index data to index buffer
-	glBufferData(GL_ARRAY_BUFFER, mesh.size() * sizeof(mesh[0]), mesh.data(), GL_STATIC_DRAW);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, index.size() * sizeof(index[0]), index.data(), GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, meshcount * sizeof(mesh[0]), mesh, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexcount * sizeof(index[0]), index, GL_STATIC_DRAW);
 
 	// Enable vertex attribute
 	// From 0: vertex, 1: normal, 2: uv coordinate, 3: tangent, 4: bitangent
@@ -69,7 +109,54 @@ void SceneProxy::InitMeshData(std::vector<MeshData> mesh, std::vector<int> index
 	glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(mesh[0]), (void*)(4 * sizeof(glm::vec3) + 2 * sizeof(glm::vec2) + sizeof(glm::ivec4)));
 
 	// Memorize index size for Draw() fucntion
-	indexsize = static_cast<unsigned int>(index.size()) * sizeof(index[0]);
+	indexsize = static_cast<unsigned int>(indexcount) * sizeof(index[0]);
+}
+
+// Same attribute locations as InitMeshData, decoded in debug_animation_packed.vert.glsl.
+// Bitangent is not a separate attribute, it is rebuilt from normal, tangent and the sign in position.w
+void SceneProxy::InitPackedMeshData(const PackedMeshData* mesh, size_t meshcount, const int* index, size_t indexcount)
+{
+	glBufferData(GL_ARRAY_BUFFER, meshcount * sizeof(mesh[0]), mesh, GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexcount * sizeof(index[0]), index, GL_STATIC_DRAW);
+
+	// From 0: vertex, 1: normal, 2: uv coordinate, 3: tangent, 5: joint index, 6: joint weight
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glEnableVertexAttribArray(3);
+	glDisableVertexAttribArray(4);
+	glEnableVertexAttribArray(5);
+	glEnableVertexAttribArray(6);
+	glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(mesh[0]), (void*)offsetof(PackedMeshData, position));
+	glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(mesh[0]), (void*)offsetof(PackedMeshData, normal));
+	glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(mesh[0]), (void*)offsetof(PackedMeshData, uv));
+	glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(mesh[0]), (void*)offsetof(PackedMeshData, tangent));
+	glVertexAttribIPointer(5, 4, GL_UNSIGNED_BYTE, sizeof(mesh[0]), (void*)offsetof(PackedMeshData, index));
+	glVertexAttribPointer(6, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(mesh[0]), (void*)offsetof(PackedMeshData, weight));
+
+	// Memorize index size for Draw() fucntion
+	indexsize = static_cast<unsigned int>(indexcount) * sizeof(index[0]);
+}
+
+void SceneProxy::InitSubMeshData(const SubMesh* submesh, size_t submeshcount)
+{
+	submeshes.assign(submesh, submesh + submeshcount);
+}
+
+void SceneProxy::InitLodData(const MeshLod* lod, size_t lodcount)
+{
+	lods.assign(lod, lod + lodcount);
+	this->lod = 0;
+}
+
+void SceneProxy::SelectLod(float i_pixelsperunit, float i_maxpixelerror)
+{
+	// Errors grow along the chain
+	lod = 0;
+	while (lod + 1 < lods.size() && lods[lod + 1].error * i_pixelsperunit <= i_maxpixelerror)
+	{
+		lod++;
+	}
 }
 
 void SceneProxy::InitSkeletonData(Skeleton skeleton, std::vector<int> index)
@@ -103,7 +190,7 @@ void SceneProxy::InitSkeletonData(Skeleton skeleton, std::vector<int> index)
 	indexsize = static_cast<unsigned int>(index.size()) * sizeof(index[0]);
 }
 
-void SceneProxy::InitSkeletonAnimationData(Skeleton skeleton, AnimationClip clip, std::vector<int> index)
+void SceneProxy::InitSkeletonAnimationData(Skeleton skeleton, std::vector<int> index)
 {
 	std::vector<AnimationSkeleton> animation_skeleton_vector;
 
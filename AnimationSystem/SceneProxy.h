@@ -4,6 +4,8 @@
 #include <glm/vec2.hpp>
 #include <gl/glew.h>
 #include <vector>
+#include <string>
+#include <cstdint>
 
 __declspec(align(16)) struct MeshData
 {
@@ -16,7 +18,38 @@ __declspec(align(16)) struct MeshData
 	glm::ivec4    index;
 	glm::vec4     weight;
 
-	MeshData() : index(glm::ivec4(-1, -1, -1, -1)), weight(glm::vec4(0, 0, 0, 0)){ }
+	MeshData() : vertex(0), normal(0), uv(0), padding(0), tangent(0), bitangent(0), index(glm::ivec4(-1, -1, -1, -1)), weight(glm::vec4(0, 0, 0, 0)){ }
+};
+
+// Compact cooked vertex, 28 bytes instead of the 112 of MeshData. Built by VertexPacker.
+struct PackedMeshData
+{
+	uint16_t position[4]; // unorm16 inside the mesh bounds, w is 65535 when the bitangent is cross(normal, tangent)
+	int16_t  normal[2];   // snorm16 octahedral
+	int16_t  tangent[2];  // snorm16 octahedral
+	uint16_t uv[2];       // half float
+	uint8_t  index[4];    // joint indices, unused influences have weight 0
+	uint8_t  weight[4];   // unorm8, sums to 255
+};
+
+// A range of the index buffer drawn with one material. Submeshes are sorted by material_id, then influence_count.
+struct SubMesh
+{
+	int       index_offset;
+	int       index_count;
+	int       material_id;     // index into the imported materials, -1 without a material
+	int       mesh_id;         // FbxMesh the triangles came from
+	int       influence_count; // most skinning influences of any vertex in the range, 0 is unskinned
+	glm::vec3 bounds_min;
+	glm::vec3 bounds_max;
+};
+
+// One level of detail, a run of the submesh table. Built by MeshSimplifier.
+struct MeshLod
+{
+	int   submesh_offset;
+	int   submesh_count;
+	float error; // largest simplification error in model units
 };
 
 struct MaterialData
@@ -68,27 +101,84 @@ struct Skeleton
 	std::vector<Joint>   joints;
 };
 
-struct JointPose
+// Joint poses of a clip stored by channel, every channel laid out [frame][joint] in one contiguous array.
+// rot, trans and scale are relative to the parent joint, parent_index is always smaller than the joint's own index.
+struct ClipPoses
 {
-	glm::quat   rot;
-	glm::vec4   trans;
-	float       scale;
-	glm::mat4   global_inverse_matrix;
-	int         parent_index;
+	int                    frame_count = 0;
+	int                    joint_count = 0;
+	std::vector<int>       parent_index; // one per joint
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> translations;
+	std::vector<float>     scales;
+
+	void Resize(int i_framecount, int i_jointcount)
+	{
+		const size_t count = static_cast<size_t>(i_framecount) * i_jointcount;
+		frame_count = i_framecount;
+		joint_count = i_jointcount;
+		parent_index.assign(i_jointcount, -1);
+		rotations.resize(count);
+		translations.resize(count);
+		scales.resize(count);
+	}
+
+	size_t Index(int i_frame, int i_joint) const
+	{
+		return static_cast<size_t>(i_frame) * joint_count + i_joint;
+	}
 };
 
+// Keys of one joint in a KeyedClipPoses, first indexes the frame and value arrays of each channel
+struct KeyedJoint
+{
+	uint32_t rotation_first;
+	uint32_t rotation_count;
+	uint32_t translation_first;
+	uint32_t translation_count;
+	uint32_t scale_first;
+	uint32_t scale_count;
+};
 
-struct AnimationSample
+// Poses reduced to the keys needed to stay within an error bound, or the keys of the fbx curves, every channel of every joint keeps its own key frames.
+// Key frames are fractional where a curve key falls between two frames. The first and the last frame are always keys.
+struct KeyedClipPoses
 {
-	std::vector<JointPose> jointposes;	
+	int                     frame_count = 0;
+	int                     joint_count = 0;
+	std::vector<KeyedJoint> joints;
+	std::vector<float>      rotation_frames;
+	std::vector<glm::quat>  rotations;
+	std::vector<float>      translation_frames;
+	std::vector<glm::vec3>  translations;
+	std::vector<float>      scale_frames;
+	std::vector<float>      scales;
+};
+
+// Local transform keys of one joint, each channel keeps its own key times in seconds
+struct AnimationTrack
+{
+	std::string            name;
+	int                    parent_index;
+	std::vector<float>     translation_times;
+	std::vector<glm::vec3> translations;
+	std::vector<float>     rotation_times;
+	std::vector<glm::quat> rotations;
+	std::vector<float>     scale_times;
+	std::vector<glm::vec3> scales;
 };
 
 struct AnimationClip
 {
+	std::string                  name;
 	Skeleton *                   pSkeleton;
 	float                        frame_per_second;
 	int                          frame_count;
-	std::vector<AnimationSample> samples;
+	ClipPoses                    poses;
+	KeyedClipPoses               keys;        // poses reduced by ClipReducer, empty until then
+	std::vector<AnimationTrack>  tracks;
+	std::vector<std::string>     joint_names; // joint of every pose and track, in order
+	float                        duration;
 	bool                         is_looping;
 };
 
@@ -116,6 +206,7 @@ public:
 	//void AddRenderState(OwningPointer<RenderState>);
 	//void ReplaceRenderState(OwningPointer<RenderState>, int);
 	void Draw();
+	void DrawSubMesh(size_t i_submesh);
 	void DrawPoint();
 	void DrawLine();
 	void DrawMeshOnly();
@@ -131,8 +222,16 @@ public:
 
 	void InitBuffer();
 	void InitMeshData(std::vector<MeshData> mesh, std::vector<int> index);
+	void InitMeshData(const MeshData* mesh, size_t meshcount, const int* index, size_t indexcount);
+	void InitPackedMeshData(const PackedMeshData* mesh, size_t meshcount, const int* index, size_t indexcount);
+	void InitSubMeshData(const SubMesh* submesh, size_t submeshcount);
+	void InitLodData(const MeshLod* lod, size_t lodcount);
+
+	// Pick the coarsest level of detail whose error stays under i_maxpixelerror, i_pixelsperunit is how many pixels
+	// one model unit covers at the distance of the object
+	void SelectLod(float i_pixelsperunit, float i_maxpixelerror = 1.0f);
 	void InitSkeletonData(Skeleton skeleton, std::vector<int> index);
-	void InitSkeletonAnimationData(Skeleton skeleton, AnimationClip clip, std::vector<int> index);
+	void InitSkeletonAnimationData(Skeleton skeleton, std::vector<int> index);
 	//void CheckDrawType(Shader i_shader);
 	void SetDrawType(DrawType i_drawtype)
 	{
@@ -146,6 +245,16 @@ public:
 	GLuint indexbufferid = 0;
 	unsigned int indexsize = 0;
 
+	// Draw ranges, empty draws the whole index buffer at once
+	std::vector<SubMesh> submeshes;
+
+	// Levels of detail as runs of submeshes, empty draws every submesh
+	std::vector<MeshLod> lods;
+	size_t lod = 0;
+
+	// Uniform location of the skinning shader's influence_count, set before every draw range when not -1
+	GLint influencelocation = -1;
+
 	// Texture data
 	std::vector<GLuint> textureids;
 	std::vector<GLuint> textureunits;
@@ -0,0 +1,116 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int i_threadcount)
+{
+	if (i_threadcount == 0)
+	{
+		i_threadcount = std::thread::hardware_concurrency();
+	}
+	if (i_threadcount == 0)
+	{
+		i_threadcount = 1;
+	}
+
+	for (unsigned int i = 0; i < i_threadcount; i++)
+	{
+		threads.emplace_back(&ThreadPool::Work, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+ThreadPool& ThreadPool::Get()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::ParallelFor(int i_begin, int i_end, const std::function<void(int, int)>& i_function, int i_chunkcount)
+{
+	int count = i_end - i_begin;
+	if (count <= 0)
+	{
+		return;
+	}
+
+	int chunkcount = i_chunkcount > 0 ? i_chunkcount : static_cast<int>(ThreadCount());
+	if (chunkcount > count)
+	{
+		chunkcount = count;
+	}
+
+	// The calling thread takes the first range itself
+	std::vector<std::future<void>> futures;
+	futures.reserve(chunkcount - 1);
+	for (int chunk = 1; chunk < chunkcount; chunk++)
+	{
+		int begin = i_begin + static_cast<int>(static_cast<long long>(count) * chunk / chunkcount);
+		int end = i_begin + static_cast<int>(static_cast<long long>(count) * (chunk + 1) / chunkcount);
+		futures.push_back(Submit([&i_function, begin, end]() { i_function(begin, end); }));
+	}
+
+	i_function(i_begin, i_begin + count / chunkcount);
+
+	for (std::future<void>& future : futures)
+	{
+		Wait(future);
+	}
+}
+
+void ThreadPool::Push(std::function<void()> i_task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push(std::move(i_task));
+	}
+	condition.notify_one();
+}
+
+bool ThreadPool::RunPendingTask()
+{
+	std::function<void()> task;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (tasks.empty())
+		{
+			return false;
+		}
+		task = std::move(tasks.front());
+		tasks.pop();
+	}
+
+	task();
+	return true;
+}
+
+void ThreadPool::Work()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			if (stopping && tasks.empty())
+			{
+				return;
+			}
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+
+		task();
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	// 0 uses one thread per hardware thread
+	explicit ThreadPool(unsigned int i_threadcount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Pool shared by the importer and the cooker
+	static ThreadPool& Get();
+
+	template <class Function>
+	auto Submit(Function&& i_function) -> std::future<decltype(i_function())>
+	{
+		using Result = decltype(i_function());
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Function>(i_function));
+		std::future<Result> result = task->get_future();
+		Push([task]() { (*task)(); });
+		return result;
+	}
+
+	// Split [i_begin, i_end) into at most i_chunkcount contiguous ranges and run them in parallel,
+	// i_function receives (begin, end). Blocks until every range is done. 0 uses ThreadCount() chunks.
+	void ParallelFor(int i_begin, int i_end, const std::function<void(int, int)>& i_function, int i_chunkcount = 0);
+
+	// Block until the future is ready, running queued tasks meanwhile so nested waits cannot starve the pool
+	template <class Result>
+	Result Wait(std::future<Result>& io_future)
+	{
+		while (io_future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			if (!RunPendingTask())
+			{
+				io_future.wait_for(std::chrono::milliseconds(1));
+			}
+		}
+		return io_future.get();
+	}
+
+	unsigned int ThreadCount() const
+	{
+		return static_cast<unsigned int>(threads.size());
+	}
+
+private:
+	void Push(std::function<void()> i_task);
+	bool RunPendingTask();
+	void Work();
+
+	std::vector<std::thread>          threads;
+	std::queue<std::function<void()>> tasks;
+	std::mutex                        mutex;
+	std::condition_variable           condition;
+	bool                              stopping = false;
+};
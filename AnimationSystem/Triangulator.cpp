@@ -0,0 +1,135 @@
+#include "Triangulator.h"
+#include <cmath>
+#include <glm/geometric.hpp>
+#include <glm/vec2.hpp>
+
+namespace
+{
+	float Cross(const glm::vec2& a, const glm::vec2& b, const glm::vec2& c)
+	{
+		return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	}
+
+	bool IsInsideTriangle(const glm::vec2& p, const glm::vec2& a, const glm::vec2& b, const glm::vec2& c)
+	{
+		return Cross(a, b, p) >= 0.0f && Cross(b, c, p) >= 0.0f && Cross(c, a, p) >= 0.0f;
+	}
+}
+
+void Triangulator::TriangulatePolygon(const glm::vec3* i_points, int i_count, std::vector<int>& o_triangles)
+{
+	if (i_count < 3)
+	{
+		return;
+	}
+
+	if (i_count == 3)
+	{
+		o_triangles.insert(o_triangles.end(), { 0, 1, 2 });
+		return;
+	}
+
+	if (i_count == 4)
+	{
+		// The shorter diagonal keeps both halves on the same side of a bent quad
+		if (glm::distance(i_points[0], i_points[2]) <= glm::distance(i_points[1], i_points[3]))
+		{
+			o_triangles.insert(o_triangles.end(), { 0, 1, 2, 0, 2, 3 });
+		}
+		else
+		{
+			o_triangles.insert(o_triangles.end(), { 0, 1, 3, 1, 2, 3 });
+		}
+		return;
+	}
+
+	size_t start = o_triangles.size();
+	if (!ClipEars(i_points, i_count, o_triangles))
+	{
+		o_triangles.resize(start);
+		Fan(i_count, o_triangles);
+	}
+}
+
+bool Triangulator::ClipEars(const glm::vec3* i_points, int i_count, std::vector<int>& o_triangles)
+{
+	// Newell's normal, then drop its largest axis to project the outline to 2D
+	glm::vec3 normal(0.0f);
+	for (int i = 0; i < i_count; i++)
+	{
+		const glm::vec3& a = i_points[i];
+		const glm::vec3& b = i_points[(i + 1) % i_count];
+		normal.x += (a.y - b.y) * (a.z + b.z);
+		normal.y += (a.z - b.z) * (a.x + b.x);
+		normal.z += (a.x - b.x) * (a.y + b.y);
+	}
+
+	glm::vec3 magnitude = glm::abs(normal);
+	if (magnitude.x + magnitude.y + magnitude.z <= 0.0f)
+	{
+		return false;
+	}
+
+	int axis = magnitude.x > magnitude.y ? (magnitude.x > magnitude.z ? 0 : 2) : (magnitude.y > magnitude.z ? 1 : 2);
+	int u = (axis + 1) % 3;
+	int v = (axis + 2) % 3;
+	// Keep the projected outline counter clockwise
+	float flip = normal[axis] < 0.0f ? -1.0f : 1.0f;
+
+	std::vector<glm::vec2> points(i_count);
+	std::vector<int> remaining(i_count);
+	for (int i = 0; i < i_count; i++)
+	{
+		points[i] = glm::vec2(i_points[i][u], i_points[i][v] * flip);
+		remaining[i] = i;
+	}
+
+	int guard = 0;
+	int i = 0;
+	while (remaining.size() > 3)
+	{
+		int count = (int)remaining.size();
+		if (guard++ > count)
+		{
+			// No ear left, the outline intersects itself
+			return false;
+		}
+
+		int prev = remaining[(i + count - 1) % count];
+		int curr = remaining[i % count];
+		int next = remaining[(i + 1) % count];
+
+		bool isEar = Cross(points[prev], points[curr], points[next]) > 0.0f;
+		for (int k = 0; isEar && k < count; k++)
+		{
+			int other = remaining[k];
+			if (other != prev && other != curr && other != next && IsInsideTriangle(points[other], points[prev], points[curr], points[next]))
+			{
+				isEar = false;
+			}
+		}
+
+		if (isEar)
+		{
+			o_triangles.insert(o_triangles.end(), { prev, curr, next });
+			remaining.erase(remaining.begin() + i % count);
+			guard = 0;
+		}
+		else
+		{
+			i++;
+		}
+		i %= (int)remaining.size();
+	}
+
+	o_triangles.insert(o_triangles.end(), { remaining[0], remaining[1], remaining[2] });
+	return true;
+}
+
+void Triangulator::Fan(int i_count, std::vector<int>& o_triangles)
+{
+	for (int i = 1; i + 1 < i_count; i++)
+	{
+		o_triangles.insert(o_triangles.end(), { 0, i, i + 1 });
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <vector>
+#include <glm/vec3.hpp>
+
+class Triangulator
+{
+public:
+	// Split one polygon into triangles, appending corner numbers in [0, i_count) to o_triangles.
+	// Quads are cut along the shorter diagonal, larger polygons are ear clipped in their best fitting plane
+	// and fall back to a fan when the outline is degenerate.
+	static void TriangulatePolygon(const glm::vec3* i_points, int i_count, std::vector<int>& o_triangles);
+
+private:
+	static bool ClipEars(const glm::vec3* i_points, int i_count, std::vector<int>& o_triangles);
+	static void Fan(int i_count, std::vector<int>& o_triangles);
+};
@@ -0,0 +1,149 @@
+#include "VertexPacker.h"
+#include <algorithm>
+#include <cmath>
+#include <glm/geometric.hpp>
+#include <glm/gtc/packing.hpp>
+
+namespace
+{
+	int16_t ToSnorm16(float i_value)
+	{
+		return static_cast<int16_t>(std::round(std::min(std::max(i_value, -1.0f), 1.0f) * 32767.0f));
+	}
+
+	uint16_t ToUnorm16(float i_value)
+	{
+		return static_cast<uint16_t>(std::round(std::min(std::max(i_value, 0.0f), 1.0f) * 65535.0f));
+	}
+
+	float SignNotZero(float i_value)
+	{
+		return i_value >= 0.0f ? 1.0f : -1.0f;
+	}
+}
+
+void VertexPacker::Pack(const std::vector<MeshData>& i_mesh, std::vector<PackedMeshData>& o_packed, glm::vec3& o_boundsmin, glm::vec3& o_boundsmax)
+{
+	o_packed.resize(i_mesh.size());
+	o_boundsmin = glm::vec3(0.0f);
+	o_boundsmax = glm::vec3(0.0f);
+	if (i_mesh.empty())
+	{
+		return;
+	}
+
+	o_boundsmin = i_mesh[0].vertex;
+	o_boundsmax = i_mesh[0].vertex;
+	for (const MeshData& vertex : i_mesh)
+	{
+		o_boundsmin = glm::min(o_boundsmin, vertex.vertex);
+		o_boundsmax = glm::max(o_boundsmax, vertex.vertex);
+	}
+
+	// A flat axis would divide by zero, any extent decodes it to the same value
+	glm::vec3 extent = o_boundsmax - o_boundsmin;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (extent[axis] <= 0.0f)
+		{
+			extent[axis] = 1.0f;
+		}
+	}
+
+	for (size_t i = 0; i < i_mesh.size(); i++)
+	{
+		const MeshData& vertex = i_mesh[i];
+		PackedMeshData& packed = o_packed[i];
+
+		glm::vec3 position = (vertex.vertex - o_boundsmin) / extent;
+		packed.position[0] = ToUnorm16(position.x);
+		packed.position[1] = ToUnorm16(position.y);
+		packed.position[2] = ToUnorm16(position.z);
+		packed.position[3] = glm::dot(glm::cross(vertex.normal, vertex.tangent), vertex.bitangent) >= 0.0f ? 65535 : 0;
+
+		EncodeOctahedral(vertex.normal, packed.normal);
+		EncodeOctahedral(vertex.tangent, packed.tangent);
+
+		packed.uv[0] = glm::packHalf1x16(vertex.uv.x);
+		packed.uv[1] = glm::packHalf1x16(vertex.uv.y);
+
+		// Round the weights, then give the rounding error to the largest one so they still sum to one
+		int total = 0;
+		int largest = 0;
+		for (int k = 0; k < 4; k++)
+		{
+			bool used = vertex.index[k] >= 0 && vertex.index[k] < 256;
+			packed.index[k] = used ? static_cast<uint8_t>(vertex.index[k]) : 0;
+			packed.weight[k] = used ? static_cast<uint8_t>(std::round(std::min(std::max(vertex.weight[k], 0.0f), 1.0f) * 255.0f)) : 0;
+			total += packed.weight[k];
+			if (packed.weight[k] > packed.weight[largest])
+			{
+				largest = k;
+			}
+		}
+		if (total > 0)
+		{
+			packed.weight[largest] = static_cast<uint8_t>(packed.weight[largest] + 255 - total);
+		}
+	}
+}
+
+MeshData VertexPacker::Unpack(const PackedMeshData& i_packed, const glm::vec3& i_boundsmin, const glm::vec3& i_boundsmax)
+{
+	MeshData vertex;
+
+	glm::vec3 position(i_packed.position[0], i_packed.position[1], i_packed.position[2]);
+	vertex.vertex = i_boundsmin + position / 65535.0f * (i_boundsmax - i_boundsmin);
+
+	vertex.normal = DecodeOctahedral(i_packed.normal);
+	vertex.tangent = DecodeOctahedral(i_packed.tangent);
+	vertex.bitangent = glm::cross(vertex.normal, vertex.tangent) * (i_packed.position[3] ? 1.0f : -1.0f);
+
+	vertex.uv = glm::vec2(glm::unpackHalf1x16(i_packed.uv[0]), glm::unpackHalf1x16(i_packed.uv[1]));
+
+	for (int k = 0; k < 4; k++)
+	{
+		vertex.index[k] = i_packed.weight[k] ? i_packed.index[k] : -1;
+		vertex.weight[k] = i_packed.weight[k] / 255.0f;
+	}
+
+	return vertex;
+}
+
+void VertexPacker::EncodeOctahedral(const glm::vec3& i_direction, int16_t o_encoded[2])
+{
+	float length = std::abs(i_direction.x) + std::abs(i_direction.y) + std::abs(i_direction.z);
+	if (length <= 0.0f)
+	{
+		o_encoded[0] = 0;
+		o_encoded[1] = 0;
+		return;
+	}
+
+	// Project onto the octahedron, then fold the lower half over the diagonals
+	float x = i_direction.x / length;
+	float y = i_direction.y / length;
+	if (i_direction.z < 0.0f)
+	{
+		float folded_x = (1.0f - std::abs(y)) * SignNotZero(x);
+		float folded_y = (1.0f - std::abs(x)) * SignNotZero(y);
+		x = folded_x;
+		y = folded_y;
+	}
+
+	o_encoded[0] = ToSnorm16(x);
+	o_encoded[1] = ToSnorm16(y);
+}
+
+glm::vec3 VertexPacker::DecodeOctahedral(const int16_t i_encoded[2])
+{
+	float x = std::max(i_encoded[0] / 32767.0f, -1.0f);
+	float y = std::max(i_encoded[1] / 32767.0f, -1.0f);
+
+	glm::vec3 direction(x, y, 1.0f - std::abs(x) - std::abs(y));
+	float fold = std::max(-direction.z, 0.0f);
+	direction.x += direction.x >= 0.0f ? -fold : fold;
+	direction.y += direction.y >= 0.0f ? -fold : fold;
+
+	return glm::normalize(direction);
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "SceneProxy.h"
+
+class VertexPacker
+{
+public:
+	// Quantize every vertex into PackedMeshData. Positions are stored relative to the returned bounds,
+	// which the vertex shader needs to decode them.
+	static void Pack(const std::vector<MeshData>& i_mesh, std::vector<PackedMeshData>& o_packed, glm::vec3& o_boundsmin, glm::vec3& o_boundsmax);
+
+	// Inverse of Pack, for checking the quantization error on the cpu
+	static MeshData Unpack(const PackedMeshData& i_packed, const glm::vec3& i_boundsmin, const glm::vec3& i_boundsmax);
+
+	// Octahedral mapping of a unit vector to snorm16, a zero vector encodes as +z
+	static void EncodeOctahedral(const glm::vec3& i_direction, int16_t o_encoded[2]);
+	static glm::vec3 DecodeOctahedral(const int16_t i_encoded[2]);
+};
@@ -13,6 +13,16 @@
 #include "ConstantBuffer.h" 
 #include "SceneProxy.h"
 #include "Importer.h"
+#include "CookedAsset.h"
+#include "ClipSampler.h"
+#include "ClipReducer.h"
+#include "ClipBitRate.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "ThreadPool.h"
+#include "BatchCooker.h"
+#include "ImportSession.h"
+#include "Profiler.h"
 
 #define PI 3.14159265
 
@@ -20,140 +30,288 @@ int FrameRate = 120;
 
 GLFWwindow * glfwwindow;
 
+// Chrome trace of the import stages, written at exit when "-trace file" is given
+const char* TracePath = nullptr;
 
-void ConvertJointPoseBySkeleton(AnimationClip& clip, Skeleton skeleton)
+void WriteProfile()
 {
-	int diff;
-	bool finished = false;
+	Profiler::Get().PrintSummary();
+	Profiler::Get().WriteTrace(TracePath);
+}
 
-	for (int i = 0; i < clip.samples.size(); i++)
-	{
-		diff = 0;
-		for (int j = 0; j < skeleton.joints.size(); j++)
-		{
-			// For now, it's hard coded. 
-			if (j > 20)
-			{
-				clip.samples[i].jointposes[j].global_inverse_matrix = clip.samples[i].jointposes[j].global_inverse_matrix * skeleton.joints[j].inversed;
-				continue;
-			}
-			if (finished)
-			{
-				clip.samples[i].jointposes[j].parent_index += diff;
-			}
 
-			if (skeleton.joints[j].parent_index != clip.samples[i].jointposes[j].parent_index)
-			{
-				JointPose empty;
-				//empty.global_inverse_matrix = skeleton.joints[j].inversed;
-				empty.global_inverse_matrix = glm::mat4(1.0);
-				empty.parent_index = skeleton.joints[j].parent_index;
-				clip.samples[i].jointposes.insert(clip.samples[i].jointposes.begin() + j, empty);
-				diff++;
-				finished = false;
-			}
-			else
-			{
-				clip.samples[i].jointposes[j].global_inverse_matrix = clip.samples[i].jointposes[j].global_inverse_matrix * skeleton.joints[j].inversed;
-				finished = true;
-			}
-		}
+// The pose arrays start out as the bind pose, tracks that hold it are not stored and keep their value
+void InterpolateMatrixInAFrame(const CookedAsset& asset, int clip, int frame, glm::quat* rotations, glm::vec3* translations, float* scales, glm::mat4* matrixs)
+{
+	ClipView view = asset.GetClip(clip);
+	if (view.joint_count > 256)
+	{
+		return;
 	}
+
+	// FrameRate counts play the whole clip once
+	float position = (float)frame * view.frame_count / FrameRate;
+	ClipSampler::SampleFrame(view, position, rotations, translations, scales);
+
+	// Poses are local to the parent joint and parents come first, so one pass gives the model space matrices
+	ClipSampler::LocalToModel(view.parent_index, view.joint_count, rotations, translations, scales, matrixs);
 }
 
-void InterpolateMatrixInAFrame(AnimationClip clip, int frame, glm::mat4* matrixs)
+glm::vec3 GetCameraRotation(float angle, glm::vec3 camera_pos, glm::vec3 model_pos)
 {
-	int clip_frame_count = clip.frame_count;
-	float frame_per_count = (float)(FrameRate) / clip_frame_count;
+	float r = glm::length(camera_pos - model_pos);
+	glm::vec3 change =  glm::vec3(r * cosf(angle * PI / 180), 0, r * sinf(angle * PI / 180));
+
+	return change + model_pos;
+}
 
-	int current_frame = 0;
-	while (frame_per_count * current_frame + frame_per_count < frame)
+// Write the skeleton and mesh of one imported file and the first clip of another into one cooked file
+bool CookAsset(ImportedFile& skeleton_file, ImportedFile& animation_file, const char* cooked_path, CookedData::VertexFormat format, ClipFormat clip_format)
+{
+	if (!skeleton_file.loaded || !animation_file.loaded || animation_file.clips.empty())
 	{
-		current_frame++;
+		return false;
 	}
 
-	if (current_frame >= clip_frame_count)
+	Skeleton& this_skeleton = skeleton_file.skeleton;
+	AnimationClip& this_clip = animation_file.clips[0];
+	this_clip.pSkeleton = &this_skeleton;
+
+	// The clip is stored in the skeleton's joint order, nothing is converted when it is loaded
+	if (!Importer::RemapToSkeleton(this_clip, this_skeleton))
+	{
+		return false;
+	}
+	// Clips read as curve keys keep their keys, resampled ones are reduced to the keys they need
+	if (clip_format == ClipFormat::Keyed && !(this_clip.tracks.empty() ? ClipReducer::Reduce(this_clip, &this_skeleton) : ClipReducer::KeysFromTracks(this_clip)))
 	{
-		current_frame = 0;
-		frame = 0;
+		return false;
 	}
 
-	if (current_frame >= clip_frame_count - 1)
+	std::vector<MeshData>& mesh = skeleton_file.mesh;
+	std::vector<int>& index = skeleton_file.index;
+	std::vector<SubMesh>& submeshes = skeleton_file.submeshes;
+	std::vector<MeshLod> lods;
+	MeshOptimizer::PruneInfluences(mesh);
+	MeshSimplifier::BuildLodChain(mesh, index, submeshes, lods);
+	MeshOptimizer::BucketInfluences(mesh, index, submeshes, lods);
+	MeshOptimizer::Optimize(mesh, index, submeshes);
+
+	return CookedAsset::Cook(cooked_path, this_skeleton, mesh, index, submeshes, lods, skeleton_file.materials, this_clip, format, clip_format);
+}
+
+// Print the influence histogram and the vertex cache statistics of every given fbx file before and after optimization
+void ReportMeshes(int count, char* files[])
+{
+	// Every file is queued up front, the next one imports while the current one is optimized
+	ImportSession session;
+	std::vector<std::future<ImportedFile>> imports;
+	for (int i = 0; i < count; i++)
 	{
-		float t = (current_frame + 1) * frame_per_count - (float)frame;
-		t /= frame_per_count;
+		imports.push_back(session.Import(files[i]));
+	}
 
-		for (int i = 0; i < clip.samples[0].jointposes.size(); i++)
+	for (int i = 0; i < count; i++)
+	{
+		ImportedFile file = ThreadPool::Get().Wait(imports[i]);
+		printf("%s\n", files[i]);
+		if (!file.loaded)
 		{
-			glm::vec4 pointA = clip.samples[current_frame].jointposes[i].trans;
-			glm::vec4 pointB = clip.samples[0].jointposes[i].trans;
+			continue;
+		}
 
-			glm::vec4 result_translation = t * pointA + (1 - t) * pointB;
+		printf("%zu submeshes\n", file.submeshes.size());
+		std::vector<MeshLod> lods;
+		MeshOptimizer::PruneInfluences(file.mesh);
+		MeshSimplifier::BuildLodChain(file.mesh, file.index, file.submeshes, lods);
+		MeshOptimizer::BucketInfluences(file.mesh, file.index, file.submeshes, lods);
+		MeshOptimizer::Optimize(file.mesh, file.index, file.submeshes);
+	}
+}
 
-			//glm::quat result_rotation = glm::normalize(glm::slerp(clip.samples[current_frame].jointposes[i].rot, clip.samples[0].jointposes[i].rot, t));
-			glm::quat result_rotation = glm::normalize(t* clip.samples[current_frame].jointposes[i].rot + (1 - t) * clip.samples[0].jointposes[i].rot);
+void ReportClips(const char* directory)
+{
+	std::string path = directory;
+	if (!path.empty() && path.back() != '/' && path.back() != '\\')
+	{
+		path += '/';
+	}
 
-			glm::mat4 RotationMatrix = glm::toMat4(result_rotation);
-			glm::mat4 answer = glm::translate(glm::mat4(1.0), glm::vec3(result_translation)) * RotationMatrix;
-			matrixs[i] = answer;
-		}
+	std::vector<std::string> files;
+	if (!BatchCooker::ListFbxFiles(path, files))
+	{
+		printf("Cannot list %s\n", directory);
+		return;
 	}
-	else
+
+	ImportSession session;
+	std::vector<std::future<ImportedFile>> imports;
+	for (const std::string& file : files)
 	{
-		float t = (current_frame + 1) * frame_per_count - (float)frame;
-		t /= frame_per_count;
+		imports.push_back(session.Import(path + file, ImportScope::AnimationOnly));
+	}
 
-		for (int i = 0; i < clip.samples[0].jointposes.size(); i++)
+	// Clips are remapped the way they are cooked, so tracks holding the bind pose are found
+	std::vector<ImportedFile> imported(files.size());
+	std::vector<std::pair<size_t, size_t>> clips;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		imported[i] = ThreadPool::Get().Wait(imports[i]);
+		for (size_t c = 0; c < imported[i].clips.size(); c++)
 		{
-			glm::vec4 pointA = clip.samples[current_frame].jointposes[i].trans;
-			glm::vec4 pointB = clip.samples[current_frame + 1].jointposes[i].trans;
-
-			glm::vec4 result_translation = t * pointA + (1 - t) * pointB;
+			AnimationClip& clip = imported[i].clips[c];
+			clip.pSkeleton = &imported[i].skeleton;
+			if (imported[i].skeleton.joints.empty() || Importer::RemapToSkeleton(clip, imported[i].skeleton))
+			{
+				clips.push_back(std::make_pair(i, c));
+			}
+		}
+	}
 
-			//glm::quat result_rotation = glm::slerp(clip.samples[current_frame].jointposes[i].rot, clip.samples[current_frame + 1].jointposes[i].rot, t);
-			glm::quat result_rotation =  glm::normalize(t* clip.samples[current_frame].jointposes[i].rot + (1 - t) * clip.samples[current_frame + 1].jointposes[i].rot);
+	// Every clip on its own, the joints of each are searched in parallel too
+	std::vector<ClipBitRateReport> reports(clips.size());
+	std::vector<char> compressed(clips.size(), 0);
+	ThreadPool::Get().ParallelFor(0, static_cast<int>(clips.size()), [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			VariableClipPoses poses;
+			const ImportedFile& file = imported[clips[i].first];
+			compressed[i] = ClipBitRate::Compress(file.clips[clips[i].second], &file.skeleton, poses, reports[i]) ? 1 : 0;
+		}
+	});
 
-			glm::mat4 RotationMatrix = glm::toMat4(result_rotation);
-			glm::mat4 answer = glm::translate(glm::mat4(1.0), glm::vec3(result_translation)) * RotationMatrix;
-			matrixs[i] = answer;
+	printf("\n%-28s %-24s %10s %10s %6s %10s %10s %10s\n", "file", "clip", "float", "bytes", "ratio", "max error", "avg error", "ms");
+	size_t floatBytes = 0, bytes = 0;
+	size_t failed = 0;
+	for (size_t i = 0; i < clips.size(); i++)
+	{
+		if (!compressed[i])
+		{
+			printf("%-28s %-24s cannot be compressed\n", files[clips[i].first].c_str(), imported[clips[i].first].clips[clips[i].second].name.c_str());
+			failed++;
+			continue;
 		}
+		const ClipBitRateReport& report = reports[i];
+		printf("%-28s %-24s %10zu %10zu %5.1fx %10.5f %10.5f %10.1f\n", files[clips[i].first].c_str(), imported[clips[i].first].clips[clips[i].second].name.c_str(),
+			report.float_bytes, report.bytes, report.bytes ? static_cast<double>(report.float_bytes) / report.bytes : 0.0,
+			report.largest_error, report.average_error, report.milliseconds);
+		floatBytes += report.float_bytes;
+		bytes += report.bytes;
 	}
+	printf("%zu clips, %zu bytes of poses compressed to %zu (%.1fx)\n", clips.size() - failed, floatBytes, bytes, bytes ? static_cast<double>(floatBytes) / bytes : 0.0);
 }
 
-glm::vec3 GetCameraRotation(float angle, glm::vec3 camera_pos, glm::vec3 model_pos)
+int main(int argc, char* argv[])
 {
-	float r = glm::length(camera_pos - model_pos);
-	glm::vec3 change =  glm::vec3(r * cosf(angle * PI / 180), 0, r * sinf(angle * PI / 180));
+	const char* skeleton_path = "../models/SK_PlayerCharacter.fbx";
+	const char* animation_path = "../models/Anim_PlayerCharacter_run.fbx";
+	const char* cooked_path = "../models/PlayerCharacter_run.cooked";
 
-	return change + model_pos;
-}
+	// "-trace file" anywhere profiles the imports, it is taken out before the other arguments are read
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (strcmp(argv[i], "-trace") == 0)
+		{
+			TracePath = argv[i + 1];
+			for (int j = i; j + 2 < argc; j++)
+			{
+				argv[j] = argv[j + 2];
+			}
+			argc -= 2;
+			break;
+		}
+	}
+	if (TracePath)
+	{
+		Profiler::Get().Enable(true);
+		atexit(WriteProfile);
+	}
 
-int main()
-{
-	std::vector<int> index;
-	std::vector<MeshData> mesh;
-	Skeleton this_skeleton;
-	AnimationClip this_clip;
-	this_clip.pSkeleton = &this_skeleton;
+	// "-meshreport file..." prints the vertex cache statistics of the given models
+	if (argc > 1 && strcmp(argv[1], "-meshreport") == 0)
+	{
+		ReportMeshes(argc - 2, argv + 2);
+		return 0;
+	}
+
+	// "-clipreport directory" compresses every clip of the fbx files in it at variable bit rates and prints size, error and time of each
+	if (argc > 2 && strcmp(argv[1], "-clipreport") == 0)
+	{
+		ReportClips(argv[2]);
+		return 0;
+	}
+
+	// "-packed" after the other arguments cooks the compact vertex format, "-quantize48" or "-quantize32" the quantized clip format,
+	// "-reduce" the clip reduced to the keys it needs, "-curvekeys" the keys of the fbx curves at their own times
+	// and "-variable" every track at the bit rate it needs
+	CookedData::VertexFormat format = CookedData::VertexFormat::Full;
+	ClipFormat clip_format = ClipFormat::Float;
+	AnimationImportMode import_mode = AnimationImportMode::Resample;
+	for (; argc > 1; argc--)
+	{
+		if (strcmp(argv[argc - 1], "-packed") == 0)
+		{
+			format = CookedData::VertexFormat::Packed;
+		}
+		else if (strcmp(argv[argc - 1], "-quantize48") == 0)
+		{
+			clip_format = ClipFormat::Quantized48;
+		}
+		else if (strcmp(argv[argc - 1], "-quantize32") == 0)
+		{
+			clip_format = ClipFormat::Quantized32;
+		}
+		else if (strcmp(argv[argc - 1], "-reduce") == 0)
+		{
+			clip_format = ClipFormat::Keyed;
+		}
+		else if (strcmp(argv[argc - 1], "-curvekeys") == 0)
+		{
+			clip_format = ClipFormat::Keyed;
+			import_mode = AnimationImportMode::CurveKeys;
+		}
+		else if (strcmp(argv[argc - 1], "-variable") == 0)
+		{
+			clip_format = ClipFormat::Variable;
+		}
+		else
+		{
+			break;
+		}
+	}
 
-	Importer fbx;
+	// "-cookdir directory" cooks every fbx in the directory that changed since the last run, without opening a window
+	if (argc > 2 && strcmp(argv[1], "-cookdir") == 0)
+	{
+		return BatchCooker::CookDirectory(argv[2], format, clip_format) ? 0 : 1;
+	}
 
-	fbx.Init("../models/SK_PlayerCharacter.fbx");
-	//fbx.Init("../models/SK_Enemy_Bird.fbx");
-	//fbx.PrintData();
-	fbx.ImportSkeletonMeshData(this_skeleton);
-	fbx.ImportMeshData(mesh, index, this_skeleton);
-	fbx.CleanUp();
+	// "-cook" only rebuilds the cooked file, otherwise it is cooked when missing or out of date
+	bool cook_only = argc > 1 && strcmp(argv[1], "-cook") == 0;
 
-	fbx.Init("../models/Anim_PlayerCharacter_run.fbx");
-	//fbx.Init("../models/Anim_PlayerCharacter_falling.fbx");
-	//fbx.Init("../models/Anim_PlayerCharacter_swim.fbx");
-	//fbx.Init("../models/Anim_Enemy_Bird_attack_down.fbx");
-	//fbx.PrintData();
-	fbx.ImportAnimationData(this_clip);
-	fbx.CleanUp();
+	// The files load on an import session and are cooked on the pool while the window and the shaders are set up
+	CookedAsset asset;
+	std::unique_ptr<ImportSession> session;
+	std::future<bool> cooking;
+	if (cook_only || !asset.Load(cooked_path))
+	{
+		session.reset(new ImportSession());
+		std::shared_ptr<std::future<ImportedFile>> skeleton_file = std::make_shared<std::future<ImportedFile>>(session->Import(skeleton_path));
+		std::shared_ptr<std::future<ImportedFile>> animation_file = std::make_shared<std::future<ImportedFile>>(session->Import(animation_path, ImportScope::AnimationOnly, import_mode));
+		cooking = ThreadPool::Get().Submit([skeleton_file, animation_file, cooked_path, format, clip_format]()
+		{
+			ImportedFile skeleton = ThreadPool::Get().Wait(*skeleton_file);
+			ImportedFile animation = ThreadPool::Get().Wait(*animation_file);
+			return CookAsset(skeleton, animation, cooked_path, format, clip_format);
+		});
 
-	ConvertJointPoseBySkeleton(this_clip, this_skeleton);
+		if (cook_only)
+		{
+			ThreadPool::Get().Wait(cooking);
+			return 0;
+		}
+	}
 
 	if (glfwInit() == GL_FALSE)
 	{
@@ -211,8 +369,24 @@ int main()
 	shader->SetShader("../Shaders/debug_polygon.vert.glsl", "../Shaders/debug_polygon.geo.glsl","../Shaders/debug_polygon.frag.glsl");
 	shader->LoadShader();
 
+	// The animation shader depends on the vertex format of the cooked file
+	if (cooking.valid() && (!ThreadPool::Get().Wait(cooking) || !asset.Load(cooked_path)))
+	{
+		return 0;
+	}
+
+	Skeleton this_skeleton;
+	asset.ToSkeleton(this_skeleton);
+
 	Shader* animationshader = new Shader();
-	animationshader->SetShader("../Shaders/debug_animation.vert.glsl", "../Shaders/debug_animation.geo.glsl", "../Shaders/debug_animation.frag.glsl");
+	if (asset.packedmesh)
+	{
+		animationshader->SetShader("../Shaders/debug_animation_packed.vert.glsl", "../Shaders/debug_animation.geo.glsl", "../Shaders/debug_animation.frag.glsl");
+	}
+	else
+	{
+		animationshader->SetShader("../Shaders/debug_animation.vert.glsl", "../Shaders/debug_animation.geo.glsl", "../Shaders/debug_animation.frag.glsl");
+	}
 	animationshader->LoadShader();
 
 	//////////////////////////////////////////////////////////////
@@ -221,7 +395,17 @@ int main()
 
 	SceneProxy proxy;
 	proxy.InitBuffer();
-	proxy.InitMeshData(mesh, index);
+	if (asset.packedmesh)
+	{
+		proxy.InitPackedMeshData(asset.packedmesh, asset.packedmesh_count, asset.index, asset.index_count);
+	}
+	else
+	{
+		proxy.InitMeshData(asset.mesh, asset.mesh_count, asset.index, asset.index_count);
+	}
+	proxy.InitSubMeshData(asset.submeshes, asset.submesh_count);
+	proxy.InitLodData(asset.lods, asset.lod_count);
+	proxy.influencelocation = glGetUniformLocation(animationshader->programid, "influence_count");
 
 	// Create skeleton
 	SceneProxy skeleton_proxy;
@@ -233,7 +417,7 @@ int main()
 	SceneProxy skeleton_animation_proxy;
 	skeleton_animation_proxy.InitBuffer();
 	std::vector<int> skeleton_index2;
-	skeleton_animation_proxy.InitSkeletonAnimationData(this_skeleton, this_clip, skeleton_index2);
+	skeleton_animation_proxy.InitSkeletonAnimationData(this_skeleton, skeleton_index2);
 
 
 	//////////////////////////////////////////////////////////////
@@ -255,13 +439,28 @@ int main()
 	view = glm::translate(view, camera_position);
 
 	ConstantData::Model constant_model;
+	constant_model.position_offset = glm::vec4(0.0f);
+	constant_model.position_scale = glm::vec4(1.0f);
+	if (asset.meshbounds)
+	{
+		constant_model.position_offset = glm::vec4(asset.meshbounds->min, 0.0f);
+		constant_model.position_scale = glm::vec4(asset.meshbounds->max - asset.meshbounds->min, 0.0f);
+	}
 
 	float angle = 0;
 	glm::vec3 obj_position = glm::vec3(0.0, -50.0f, -300.0f);
 
 	int animation_sample_count = 0;
 
+	// Same limit as the matrices of the animation constant buffer
 	glm::mat4 interpolated_matrix[256];
+	glm::quat pose_rotations[256];
+	glm::vec3 pose_translations[256];
+	float pose_scales[256];
+	if (asset.joint_count <= 256)
+	{
+		asset.GetBindPose(pose_rotations, pose_translations, pose_scales);
+	}
 	
 
 	//////////////////////////////////////////////////////////////
@@ -310,22 +509,22 @@ int main()
 
 
 
-		// Calculate skeleton's matrix
-		InterpolateMatrixInAFrame(this_clip, animation_sample_count, interpolated_matrix);
-		if (!this_clip.samples.empty())
+		// Calculate skeleton's matrix, a clip with more joints than the constant buffer holds is not played
+		if (asset.clip_count > 0 && asset.clips[0].frame_count > 0 && asset.clips[0].joint_count <= 256)
 		{
-			int fixed_frame = (int)(animation_sample_count / ((float)FrameRate / animation_sample_count));
-			if (fixed_frame >= 14)
-				fixed_frame = 0;
+			InterpolateMatrixInAFrame(asset, 0, animation_sample_count, pose_rotations, pose_translations, pose_scales, interpolated_matrix);
 
-			for (int i = 0; i < this_clip.samples[0].jointposes.size(); i++)
+			for (int i = 0; i < asset.clips[0].joint_count; i++)
 			{
-				//animation_inversed_matrix.global_inversed_matrix[i] = this_clip.samples[fixed_frame].jointposes[i].global_inverse_matrix * this_skeleton.joints[i].inversed;
-				animation_inversed_matrix.global_inversed_matrix[i] = interpolated_matrix[i] * this_skeleton.joints[i].inversed;
+				animation_inversed_matrix.global_inversed_matrix[i] = interpolated_matrix[i] * asset.joints[i].inversed;
 			}
 			buffer2.Update(&animation_inversed_matrix);
 		}
 
+		// Screen size of one model unit at the character, picks the level of detail
+		float pixels_per_unit = 1080.0f / (2.0f * glm::length(current_camera_pos - obj_position) * tanf(glm::radians(45.0f) * 0.5f));
+		proxy.SelectLod(pixels_per_unit);
+
 		// draw animation
 		animationshader->BindShader();
 		proxy.Draw();
@@ -21,37 +21,23 @@ layout (std140, binding = 6) uniform const_animation_skeleton
 	mat4 global_inversed_matrix[MAX_BONE_NUM];
 };
 
+// Influences of the draw range, see MeshOptimizer::BucketInfluences. The same for every vertex of a draw,
+// so the loop does not diverge and a range only fetches the matrices it needs.
+uniform int influence_count;
+
 void main()
 {
-
-	if(index.y == -1){
-
-		gl_Position = model_view_perspective_matrix * global_inversed_matrix[index.x] *  vec4(model_position, 1);
-
-	}else if(index.z == -1){
-
-		gl_Position = model_view_perspective_matrix * (weight.x * global_inversed_matrix[index.x] *  vec4(model_position, 1)
-		                                             + weight.y * global_inversed_matrix[index.y] *  vec4(model_position, 1));
-
-	}else if(index.w == -1){
-
-		gl_Position = model_view_perspective_matrix * (weight.x * global_inversed_matrix[index.x] *  vec4(model_position, 1)
-		                                             + weight.y * global_inversed_matrix[index.y] *  vec4(model_position, 1)
-													 + weight.z * global_inversed_matrix[index.z] *  vec4(model_position, 1));		
-
-	}else{
-
-		gl_Position = model_view_perspective_matrix * (weight.x * global_inversed_matrix[index.x] *  vec4(model_position, 1)
-		                                             + weight.y * global_inversed_matrix[index.y] *  vec4(model_position, 1)
-													 + weight.z * global_inversed_matrix[index.z] *  vec4(model_position, 1)
-													 + weight.w * global_inversed_matrix[index.w] *  vec4(model_position, 1));
-
+	// Unskinned ranges stay in model space
+	mat4 skin = mat4(1.0);
+	if (influence_count > 0)
+	{
+		// Vertices with fewer influences than the range have weight 0 and index -1 in the remaining slots
+		skin = weight.x * global_inversed_matrix[max(index.x, 0)];
+		for (int i = 1; i < influence_count; i++)
+		{
+			skin += weight[i] * global_inversed_matrix[max(index[i], 0)];
+		}
 	}
 
-	// gl_Position = model_view_perspective_matrix * (weight.x * global_inversed_matrix[index.x] *  vec4(model_position, 1)
-	// 											 + weight.y * global_inversed_matrix[index.y] *  vec4(model_position, 1)
-	// 											 + weight.z * global_inversed_matrix[index.z] *  vec4(model_position, 1)
-	// 											 + weight.w * global_inversed_matrix[index.w] *  vec4(model_position, 1));
-
-	//gl_Position = model_view_perspective_matrix * vec4(model_position, 1);
-}
\ No newline at end of file
+	gl_Position = model_view_perspective_matrix * skin * vec4(model_position, 1);
+}
@@ -0,0 +1,66 @@
+#version 420 core
+
+// PackedMeshData, see SceneProxy::InitPackedMeshData
+layout (location = 0) in vec4  model_position; // unorm16 in the mesh bounds, w is the bitangent sign
+layout (location = 1) in vec2  model_normal;   // snorm16 octahedral
+layout (location = 3) in vec2  model_tangent;  // snorm16 octahedral
+layout (location = 5) in uvec4 index;
+layout (location = 6) in vec4  weight;         // unused influences have weight 0
+
+out vec3 world_normal;
+out vec3 world_tangent;
+out vec3 world_bitangent;
+
+// Consta data
+const int   MAX_BONE_NUM = 256;
+
+layout (std140, binding = 1) uniform const_drawcall
+{
+	mat4 model_position_matrix;
+	mat4 model_view_perspective_matrix;
+	mat4 model_inverse_transpose_matrix;
+	vec4 position_offset;
+	vec4 position_scale;
+};
+
+layout (std140, binding = 6) uniform const_animation_skeleton
+{
+	mat4 global_inversed_matrix[MAX_BONE_NUM];
+};
+
+// Influences of the draw range, see MeshOptimizer::BucketInfluences
+uniform int influence_count;
+
+vec3 DecodeOctahedral(vec2 e)
+{
+	vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-v.z, 0.0);
+	v.xy += vec2(v.x >= 0.0 ? -t : t, v.y >= 0.0 ? -t : t);
+	return normalize(v);
+}
+
+void main()
+{
+	vec4 position = vec4(position_offset.xyz + model_position.xyz * position_scale.xyz, 1);
+	vec3 normal = DecodeOctahedral(model_normal);
+	vec3 tangent = DecodeOctahedral(model_tangent);
+	vec3 bitangent = cross(normal, tangent) * (model_position.w * 2.0 - 1.0);
+
+	// Weights always sum to one and unused slots have weight 0, so the range's influence count
+	// is the only thing the blend depends on and it is uniform across the draw
+	mat4 skin = mat4(1.0);
+	if (influence_count > 0)
+	{
+		skin = weight.x * global_inversed_matrix[index.x];
+		for (int i = 1; i < influence_count; i++)
+		{
+			skin += weight[i] * global_inversed_matrix[index[i]];
+		}
+	}
+
+	world_normal = normalize(mat3(skin) * normal);
+	world_tangent = normalize(mat3(skin) * tangent);
+	world_bitangent = normalize(mat3(skin) * bitangent);
+
+	gl_Position = model_view_perspective_matrix * skin * position;
+}